@@ -2,24 +2,47 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
+#include <limits.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <assert.h>
 #include <readline/readline.h>
+#include <readline/history.h>
 #include <netinet/in.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <linux/errqueue.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <linux/tcp.h>
 #include "netinet/in.h"
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <sched.h>
 
 typedef void (*sighandler_t)(int);
 
@@ -40,104 +63,128 @@ typedef void (*sighandler_t)(int);
 /*  Constants.  */
 #define MAXTOKENS        100                /*  Maximum tokens in command line  */
 #define CMDDELIMS        " ,="              /*  Command token delimiters  */
-#define MAXSOCKETS       10                 /*  Maximum sockets open simultaneously  */
-#define UNUSED_FD         -1                /*  Value for gSockfd  */
+#define CMDSEPARATORS    ";{}"              /*  Tokens of their own, with or without spaces  */
+#define INITIAL_SOCKETS  16                 /*  Socket table slots allocated at startup  */
+#define UNUSED_FD         -1                /*  Value for an unused fd  */
 #define MAX_PROMPT_LENGTH  20               /*  Maximum length of prompt string  */
 #define BUFFER_SIZE      100                /*  Size of read/write buffer  */  
 #define MAX_DATA_DISPLAY 64                 /*  Bytes of incoming packets to display  */
+#define MAX_WORKERS      1024               /*  Most threads the workers command starts  */
+#define MAX_COMMAND_LINE 256                /*  Longest command built by runCommandLine()  */
 typedef enum {READ_READY, WRITE_READY, EXCEPT_READY} readyCondition;   
                                             /*  Which condition does the fd have to be ready for?  */
 
 
-/*  Global variables.  */
+/*  
+ *  Global variables.  Anything a command works on is __thread, so each worker thread 
+ *  started by the workers command has its own sockets, model and results.
+ */
 static int gVerbose = FALSE;                 /*  gVerbose selected on command line?  */
-static int gCurrent = 0;                     /*  Index of "gCurrent" socket  */
-static int gSockfd[MAXSOCKETS] = {           /*  fd of test socket  */
-    UNUSED_FD, UNUSED_FD, UNUSED_FD, UNUSED_FD, UNUSED_FD,
-    UNUSED_FD, UNUSED_FD, UNUSED_FD, UNUSED_FD, UNUSED_FD
-};                            
-static char *gTokens[MAXTOKENS];             /*  Separated command gTokens  */
-static int gTokenCount;                      /*  Number of gTokens  */
-enum {
-    BLOCKING_MODEL, NONBLOCKING_MODEL, SELECT_MODEL, SIGNAL_MODEL
-} model = BLOCKING_MODEL;                    /*  Mode in which APIs are exercised  */
-static int gDomain;                          /*  domain specified when socket created  */
-static int gType;                            /*  type specified when socket created  */
-static int gProtocol;                        /*  protocol specified when socket created  */
-static int gInterrupted;                     /*  Received an interrupt from the user  */
-
-
-/*  Command definitions.  Enumeration and string table must be kept in sync.  */
+static __thread int gCurrent = 0;            /*  Index of "gCurrent" socket  */
+static __thread char *gTokens[MAXTOKENS];    /*  Separated command gTokens  */
+static __thread int gTokenCount;             /*  Number of gTokens  */
+enum model_enum {
+    BLOCKING_MODEL, NONBLOCKING_MODEL, SELECT_MODEL, SIGNAL_MODEL, EPOLL_MODEL, EPOLLET_MODEL,
+    IOURING_MODEL, RTSIGNAL_MODEL,
+
+    NUM_MODELS                               /*  MUST BE AT END  */
+};
+static char *gModelNames[] = {
+    "blocking", "nonblocking", "select", "signal", "epoll", "epollet", 
+    "iouring", "rtsignal"
+};
+static __thread enum model_enum gModel = BLOCKING_MODEL;  /*  Model given to newly created sockets  */
+static int gInterrupted;                     /*  Received an interrupt from the user, in any thread  */
+static long long gLastSendNs;                /*  When data was last sent, by any thread  */
+
+
+/*  Per-socket state.  The table grows on demand; unused slots are kept on a free list.  */
+struct socketInfo {
+    int fd;                                  /*  fd of test socket, or UNUSED_FD  */
+    int domain;                              /*  domain specified when socket created  */
+    int type;                                /*  type specified when socket created  */
+    int protocol;                            /*  protocol specified when socket created  */
+    enum model_enum model;                   /*  Mode in which APIs are exercised  */
+    int nextFree;                            /*  Next slot on the free list  */
+    int nonblocking;                         /*  Is O_NONBLOCK set on the fd?  */
+    unsigned epollEvents;                    /*  Events registered with epoll, 0 if none  */
+    unsigned epollReady;                     /*  Edge-triggered readiness not yet consumed  */
+    int rtsignalArmed;                       /*  Set up to raise RTSIGNAL at this thread?  */
+    long apiCalls;                           /*  APIs timed on this socket  */
+    long apiErrors;                          /*  APIs that returned an error  */
+    long long apiNs;                         /*  Time spent in those APIs, in ns.  */
+    long long bytesIn, bytesOut;             /*  Data received and sent  */
+};
+static __thread struct socketInfo *gSockets; /*  Socket table  */
+static __thread int gSocketSlots;            /*  Slots allocated in gSockets  */
+static __thread int gFreeSlot = -1;          /*  First slot on the free list, or -1  */
+static __thread struct socketInfo gRetired;  /*  Totals of the sockets closed so far  */
+static __thread int gWorker = -1;            /*  Worker number, or -1 in the main thread  */
+
+
+/*
+ *  Command definitions.  Each command's enumeration, name, handler and usage all come from
+ *  this one table, so there is nothing to keep in sync.
+ */
+#define COMMAND_TABLE \
+    COMMAND(CMD_QUIT,        "quit",        doQuit,        "quit") \
+    COMMAND(CMD_HELP,        "help",        doHelp,        "help") \
+    COMMAND(CMD_MODEL,       "model",       doModel,       "model *blocking | nonblocking | select | signal | rtsignal | epoll | epollet | iouring [-b batch] [-f] [-r] [-t timeout]") \
+    COMMAND(CMD_USE,         "use",         doUse,         "use number") \
+    COMMAND(CMD_SOCKET,      "socket",      doSocket,      "socket [-d domain] [-t type] [-p protocol]") \
+    COMMAND(CMD_BIND,        "bind",        doBind,        "bind portnumber [ hostaddress ]") \
+    COMMAND(CMD_CONNECT,     "connect",     doConnect,     "connect portnumber [ hostaddress ]") \
+    COMMAND(CMD_LISTEN,      "listen",      doListen,      "listen [backlogCount]") \
+    COMMAND(CMD_ACCEPT,      "accept",      doAccept,      "accept [-d]") \
+    COMMAND(CMD_SHARDS,      "shards",      doShards,      "shards count port duration [-c clients] [-a hostaddress] [-b backlog]") \
+    COMMAND(CMD_CONNSTORM,   "connstorm",   doConnstorm,   "connstorm clients duration [-a hostaddress] [-r]") \
+    COMMAND(CMD_RECVMSG,     "recvmsg",     doRecvmsg,     "recvmsg [-f OOB]") \
+    COMMAND(CMD_SENDMSG,     "sendmsg",     doSendmsg,     "sendmsg [-a hostaddress port] [-f OOB | ZEROCOPY]") \
+    COMMAND(CMD_SENDMMSG,    "sendmmsg",    doSendmmsg,    "sendmmsg [-a hostaddress port] [-b batch] [-s size] [-n count]") \
+    COMMAND(CMD_RECVMMSG,    "recvmmsg",    doRecvmmsg,    "recvmmsg [-b batch] [-s size] [-n count]") \
+    COMMAND(CMD_READ,        "read",        doRead,        "read [-n bytes] [-s chunk]") \
+    COMMAND(CMD_WRITE,       "write",       doWrite,       "write [-n bytes] [-s chunk] [-z]") \
+    COMMAND(CMD_SENDFILE,    "sendfile",    doSendfile,    "sendfile path [-n bytes] [-s chunk] [-p]") \
+    COMMAND(CMD_PINGPONG,    "pingpong",    doPingpong,    "pingpong count size peerSocket") \
+    COMMAND(CMD_SWEEP,       "sweep",       doSweep,       "sweep port bytes name value[/value...] ... [-s chunk] [-r roundtrips] [-a hostaddress]") \
+    COMMAND(CMD_STATS,       "stats",       doStats,       "stats [reset]") \
+    COMMAND(CMD_SETSOCKOPT,  "setsockopt",  doSetsockopt,  "setsockopt name value | level opt -i value") \
+    COMMAND(CMD_GETSOCKOPT,  "getsockopt",  doGetsockopt,  "getsockopt [name | level opt -i]") \
+    COMMAND(CMD_TCPINFO,     "tcpinfo",     doTcpinfo,     "tcpinfo [-i interval] [-x csv | json] [-o file]") \
+    COMMAND(CMD_MULTIJOIN,   "multijoin",   doMultijoin,   "multijoin interfaceIndex hostaddress [sourceaddress]") \
+    COMMAND(CMD_MULTILEAVE,  "multileave",  doMultileave,  "multileave interfaceIndex hostaddress [sourceaddress]") \
+    COMMAND(CMD_MULTICAST,   "multicast",   doMulticast,   "multicast group port count [-i interfaceIndex] [-s size] [-r rate] [-b rcvbuf]") \
+    COMMAND(CMD_MULTISCALE,  "multiscale",  doMultiscale,  "multiscale port groups [-k sockets] [-n packets] [-i interfaceIndex] [-a sourceaddress] [-d inet | inet6]") \
+    COMMAND(CMD_SHUTDOWN,    "shutdown",    doShutdown,    "shutdown [SHUT_RD | SHUT_WR | SHUT_RDWR]") \
+    COMMAND(CMD_GETSOCKNAME, "getsockname", doGetsockname, "getsockname") \
+    COMMAND(CMD_GETPEERNAME, "getpeername", doGetpeername, "getpeername") \
+    COMMAND(CMD_CLOSE,       "close",       doClose,       "close") \
+    COMMAND(CMD_SOCKETS,     "sockets",     doSockets,     "sockets") \
+    COMMAND(CMD_REPEAT,      "repeat",      doBlockOnly,   "repeat count { command ; ... }") \
+    COMMAND(CMD_FOR,         "for",         doBlockOnly,   "for duration { command ; ... }") \
+    COMMAND(CMD_WORKERS,     "workers",     doBlockOnly,   "workers count { command ; ... }")
+
 enum command_enum {
-    CMD_QUIT = 0,
-    CMD_HELP,
-    CMD_MODEL,
-    CMD_USE,
-    CMD_SOCKET,
-    CMD_BIND,
-    CMD_CONNECT,
-    CMD_LISTEN,
-    CMD_ACCEPT,
-    CMD_RECVMSG,
-    CMD_SENDMSG,
-    CMD_READ,
-    CMD_WRITE,
-    CMD_SETSOCKOPT,
-    CMD_GETSOCKOPT,
-    CMD_MULTIJOIN,
-    CMD_MULTILEAVE,
-    CMD_SHUTDOWN,
-    CMD_GETSOCKNAME,
-    CMD_GETPEERNAME,
-    CMD_CLOSE,
-     
+#define COMMAND(id, name, handler, usage)  id,
+    COMMAND_TABLE
+#undef COMMAND
     NUM_COMMANDS                            /*  MUST BE AT END  */
 };
-static char *gCommands[] = {
-    "quit",
-    "help",
-    "model",
-    "use",
-    "socket",
-    "bind",
-    "connect",
-    "listen",
-    "accept",
-    "recvmsg",
-    "sendmsg",
-    "read",
-    "write",
-    "setsockopt",
-    "getsockopt",
-    "multijoin",
-    "multileave",
-    "shutdown",
-    "getsockname",
-    "getpeername",
-    "close"
+
+#define COMMAND(id, name, handler, usage)  static void handler();
+COMMAND_TABLE
+#undef COMMAND
+
+struct commandInfo {
+    char *name;
+    void (*handler)();
+    char *usage;
 };
-static char *gUsage[] = {
-    "quit",
-    "help",
-    "model *blocking | nonblocking | select | signal",
-    "use number",
-    "socket [-d domain] [-t type] [-p protocol]",
-    "bind portnumber [ hostaddress ]",
-    "connect portnumber [ hostaddress ]",
-    "listen [backlogCount]",
-    "accept",
-    "recvmsg [-f OOB]",
-    "sendmsg [-a hostaddress port] [-f OOB]",
-    "read",
-    "write",
-    "setsockopt level opt [-i value]",
-    "getsockopt level opt [-i]",
-    "multijoin interfaceIndex hostaddress",
-    "multileave interfaceIndex hostaddress",
-    "shutdown [SHUT_RD | SHUT_WR | SHUT_RDWR]",
-    "getsockname",
-    "getpeername",
-    "close"
+
+static const struct commandInfo gCommandTable[NUM_COMMANDS] = {
+#define COMMAND(id, name, handler, usage)  {name, handler, usage},
+    COMMAND_TABLE
+#undef COMMAND
 };
 
 
@@ -158,21 +205,168 @@ static int setIntegerArgument(const char *param, int *value)
 }
 
 
-/*  Translate a named option value into an integer.  */
-static int getNamedValue(char *token, char *strings[], int values[], int *resultValue)
+/*  Translate a byte count, optionally suffixed with k, m or g, into a binary value.  */
+static int setSizeArgument(const char *param, long long *value)
+{
+    long long temp_value;
+    char suffix = 0;
+    int result;
+
+    result = sscanf(param, "%lli%c", &temp_value, &suffix);
+    if (result < 1){
+        fprintf(stderr, "%s is not a valid value.\n", param);
+        return 1;
+    }
+    switch (tolower(suffix)){
+        case 0:                                      break;
+        case 'k':  temp_value <<= 10;                break;
+        case 'm':  temp_value <<= 20;                break;
+        case 'g':  temp_value <<= 30;                break;
+        default:
+            fprintf(stderr, "%s is not a valid value.\n", param);
+            return 1;
+    }
+
+    *value = temp_value;
+    return 0;
+}
+
+
+/*  Translate a duration such as 10, 1.5s, 250ms, 100us or 2m into ns.  */
+static int setDurationArgument(const char *param, long long *value)
+{
+    double amount;
+    char unit[4] = "s";
+    
+    if (sscanf(param, "%lf%3s", &amount, unit) < 1 || amount < 0){
+        fprintf(stderr, "%s is not a valid duration.\n", param);
+        return 1;
+    }
+    if (strcasecmp(unit, "s") == 0)
+        *value = amount * 1e9;
+    else if (strcasecmp(unit, "ms") == 0)
+        *value = amount * 1e6;
+    else if (strcasecmp(unit, "us") == 0)
+        *value = amount * 1e3;
+    else if (strcasecmp(unit, "m") == 0)
+        *value = amount * 60e9;
+    else {
+        fprintf(stderr, "%s is not a valid duration.\n", param);
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+ *  Name lookup.  Command names and named option values are found through a perfect hash:
+ *  a seed is searched for that sends every name in a table to a slot of its own, so a
+ *  lookup costs one hash and one string compare.  Case is ignored, as names are typed in
+ *  any case but tokens keep theirs for paths and string values.  There is no generator 
+ *  step in the build, so the command index is built at startup and each option table's 
+ *  index on its first use.
+ */
+struct nameIndex {
+    unsigned seed;
+    unsigned mask;                           /*  Number of slots - 1  */
+    short *slots;                            /*  1 + index of the name in each slot, or 0  */
+};
+
+/*  Names are found stride bytes apart, so both string arrays and structure tables work.  */
+#define NAME_AT(names, stride, i)  (*(char * const *)((const char *)(names) + (i) * (stride)))
+
+#define MAX_NAME_SLOTS 4096
+#define MAX_NAME_SEEDS 1000
+
+struct namedValue {
+    char *name;
+    int value;
+};
+
+static pthread_mutex_t gNameIndexLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*  Seeded FNV-1a over the lower-cased name.  */
+static unsigned hashName(const char *name, unsigned seed)
+{
+    unsigned hash = 2166136261u ^ seed;
+    
+    while (*name != '\0'){
+        hash ^= (unsigned char) tolower((unsigned char) *name++);
+        hash *= 16777619u;
+    }
+    return hash ^ (hash >> 16);
+}
+
+
+/*  Find a seed that hashes count names to distinct slots, growing the table as needed.  */
+static int buildNameIndex(struct nameIndex *index, const void *names, size_t stride, int count)
+{
+    unsigned size, seed, slot;
+    short *slots;
+    int i;
+    
+    for (size = 8; size < 2 * (unsigned) count; size *= 2)
+        ;
+    for (; size <= MAX_NAME_SLOTS; size *= 2){
+        slots = calloc(size, sizeof(short));
+        if (slots == NULL)
+            return -1;
+        for (seed = 1; seed <= MAX_NAME_SEEDS; seed++){
+            for (i = 0; i < count; i++){
+                slot = hashName(NAME_AT(names, stride, i), seed) & (size - 1);
+                if (slots[slot] != 0)
+                    break;
+                slots[slot] = i + 1;
+            }
+            if (i == count){
+                index->seed = seed;
+                index->mask = size - 1;
+                __atomic_store_n(&index->slots, slots, __ATOMIC_RELEASE);
+                return 0;
+            }
+            memset(slots, 0, size * sizeof(short));
+        }
+        free(slots);
+    }
+    return -1;
+}
+
+
+/*  Look a name up in an index built over the same names.  Returns its index, or -1.  */
+static int lookupName(const struct nameIndex *index, const void *names, size_t stride, const char *name)
+{
+    int i;
+    
+    i = index->slots[hashName(name, index->seed) & index->mask] - 1;
+    if (i < 0 || strcasecmp(name, NAME_AT(names, stride, i)) != 0)
+        return -1;
+    return i;
+}
+
+
+/*  Translate a named option value, in any case, into an integer.  The table ends with a NULL name.  */
+static int getNamedValue(char *token, const struct namedValue table[], struct nameIndex *index, int *resultValue)
 {
     int i;
     char *ptr;
     
-    /*  Force to connonical lower case.  */
-    for (i = 0; i < strlen(token); i++)
-        token[i] = tolower(token[i]);
-        
-    /*  Search through the provided names.  */
-    for (i = 0; strings[i] != NULL; i++)
-        if (strcmp(token, strings[i]) == 0){
-            *resultValue = values[i];
-            return 0;
+    /*  Workers may get here together, so the index is built under a lock.  */
+    if (__atomic_load_n(&index->slots, __ATOMIC_ACQUIRE) == NULL){
+        pthread_mutex_lock(&gNameIndexLock);
+        for (i = 0; index->slots == NULL && table[i].name != NULL; i++)
+            ;
+        if (index->slots == NULL && buildNameIndex(index, &table[0].name, sizeof(table[0]), i) != 0){
+            pthread_mutex_unlock(&gNameIndexLock);
+            fprintf(stderr, "Unable to index option names.\n");
+            return -1;
+        }
+        pthread_mutex_unlock(&gNameIndexLock);
+    }
+    i = lookupName(index, &table[0].name, sizeof(table[0]), token);
+    if (i >= 0){
+        *resultValue = table[i].value;
+        return 0;
     }
     *resultValue = strtol(token, &ptr, 0);
     if (ptr == token){
@@ -184,21 +378,177 @@ static int getNamedValue(char *token, char *strings[], int values[], int *result
 }
 
 
-/*  Find a free socket slot.  */
-static int findFreeSocketSlot()
+/*
+ *  Option parsing.  getopt() keeps its state in globals, so commands use this reentrant 
+ *  version, which keeps it per thread.  Like GNU getopt(), it moves arguments that aren't 
+ *  options to the end, and setting gOptind to 0 starts over with a new argument list.
+ */
+static __thread int gOptind;                 /*  Next argument to process  */
+static __thread char *gOptarg;               /*  Argument of the option just returned  */
+static __thread char *optNext;               /*  Rest of an argument holding grouped options  */
+static __thread int optFirstNonopt, optLastNonopt;
+                                             /*  Arguments skipped over that aren't options  */
+
+/*  Swap the block of arguments [first, middle) with [middle, end).  */
+static void exchangeArguments(char *argv[], int first, int middle, int end)
 {
-    int i;
+    char *temp;
+    int i, j;
     
-    /*  Find a free socket slot.  */
-    for (i = 0; i < MAXSOCKETS; i++){
-        if (gSockfd[i] == UNUSED_FD)
-            break;
+    for (i = first, j = end - 1; i < j; i++, j--){
+        temp = argv[i];  argv[i] = argv[j];  argv[j] = temp;
+    }
+    for (i = first, j = first + end - middle - 1; i < j; i++, j--){
+        temp = argv[i];  argv[i] = argv[j];  argv[j] = temp;
+    }
+    for (i = first + end - middle, j = end - 1; i < j; i++, j--){
+        temp = argv[i];  argv[i] = argv[j];  argv[j] = temp;
+    }
+}
+
+
+/*  Move the options processed since the last non-options skipped ahead of them.  */
+static void permuteArguments(char *argv[])
+{
+    if (optFirstNonopt != optLastNonopt && optLastNonopt != gOptind){
+        exchangeArguments(argv, optFirstNonopt, optLastNonopt, gOptind);
+        optFirstNonopt += gOptind - optLastNonopt;
+    } else if (optLastNonopt != gOptind)
+        optFirstNonopt = gOptind;
+}
+
+
+/*  Return the next option letter, '?' on error, or -1 once the options are used up.  */
+static int getOption(int argc, char *argv[], const char *optstring)
+{
+    const char *spec;
+    char letter;
+    
+    if (gOptind == 0){
+        gOptind = optFirstNonopt = optLastNonopt = 1;
+        optNext = NULL;
+    }
+    gOptarg = NULL;
+    
+    /*  Move on to the next argument holding options.  */
+    if (optNext == NULL || *optNext == '\0'){
+        optFirstNonopt = MIN(optFirstNonopt, gOptind);
+        optLastNonopt = MIN(optLastNonopt, gOptind);
+        permuteArguments(argv);
+        while (gOptind < argc && (argv[gOptind][0] != '-' || argv[gOptind][1] == '\0'))
+            gOptind++;
+        optLastNonopt = gOptind;
+        if (gOptind < argc && strcmp(argv[gOptind], "--") == 0){
+            gOptind++;
+            permuteArguments(argv);
+            optLastNonopt = gOptind = argc;
+        }
+        if (gOptind >= argc){
+            if (optFirstNonopt != optLastNonopt)
+                gOptind = optFirstNonopt;
+            optNext = NULL;
+            return -1;
+        }
+        optNext = argv[gOptind] + 1;
     }
-    if (i >= MAXSOCKETS){
-        fprintf(stderr, "All %d sockets are in use.\n", MAXSOCKETS);
+    
+    letter = tolower((unsigned char) *optNext++);
+    spec = letter == ':' ? NULL : strchr(optstring, letter);
+    if (spec == NULL){
+        fprintf(stderr, "%s:  invalid option -- '%c'\n", argv[0], letter);
+        if (*optNext == '\0')
+            gOptind++;
+        return '?';
+    }
+    if (spec[1] != ':'){
+        if (*optNext == '\0')
+            gOptind++;
+        return letter;
+    }
+    
+    /*  The option's argument is the rest of this argument, or the next one.  */
+    if (*optNext != '\0')
+        gOptarg = optNext;
+    else if (gOptind + 1 < argc)
+        gOptarg = argv[++gOptind];
+    else {
+        fprintf(stderr, "%s:  option requires an argument -- '%c'\n", argv[0], letter);
+        gOptind++;
+        optNext = NULL;
+        return '?';
+    }
+    gOptind++;
+    optNext = NULL;
+    return letter;
+}
+
+
+/*  Double the size of the socket table, putting the new slots on the free list.  */
+static int growSocketTable()
+{
+    struct socketInfo *newSockets;
+    int i, newSlots;
+    
+    newSlots = gSocketSlots ? gSocketSlots * 2 : INITIAL_SOCKETS;
+    newSockets = realloc(gSockets, newSlots * sizeof(*newSockets));
+    if (newSockets == NULL){
+        fprintf(stderr, "Unable to grow socket table to %d sockets.\n", newSlots);
         return -1;
     }
-    return i;
+    
+    /*  Chain the new slots in ascending order ahead of any existing free slots.  */
+    memset(&newSockets[gSocketSlots], 0, (newSlots - gSocketSlots) * sizeof(*newSockets));
+    for (i = newSlots - 1; i >= gSocketSlots; i--){
+        newSockets[i].fd = UNUSED_FD;
+        newSockets[i].model = gModel;
+        newSockets[i].nextFree = gFreeSlot;
+        gFreeSlot = i;
+    }
+    gSockets = newSockets;
+    gSocketSlots = newSlots;
+    return 0;
+}
+
+
+/*  Find a free socket slot.  It stays free until claimed by claimSocketSlot().  */
+static int findFreeSocketSlot()
+{
+    if (gFreeSlot < 0 && growSocketTable() < 0)
+        return -1;
+    return gFreeSlot;
+}
+
+
+/*  Take the slot returned by findFreeSocketSlot() off the free list and give it an open fd.  */
+static void claimSocketSlot(int slot, int fd, int domain, int type, int protocol, enum model_enum model, 
+                                int nonblocking)
+{
+    struct socketInfo *info = &gSockets[slot];
+    
+    assert(slot == gFreeSlot);
+    gFreeSlot = info->nextFree;
+    memset(info, 0, sizeof(*info));
+    info->fd = fd;
+    info->domain = domain;
+    info->type = type;
+    info->protocol = protocol;
+    info->model = model;
+    info->nonblocking = nonblocking;
+    info->nextFree = -1;
+}
+
+
+/*  Return a slot whose fd has been closed to the free list.  */
+static void releaseSocketSlot(int slot)
+{
+    gRetired.apiCalls += gSockets[slot].apiCalls;
+    gRetired.apiErrors += gSockets[slot].apiErrors;
+    gRetired.apiNs += gSockets[slot].apiNs;
+    gRetired.bytesIn += gSockets[slot].bytesIn;
+    gRetired.bytesOut += gSockets[slot].bytesOut;
+    gSockets[slot].fd = UNUSED_FD;
+    gSockets[slot].nextFree = gFreeSlot;
+    gFreeSlot = slot;
 }
 
 
@@ -207,13 +557,13 @@ extern void setFctlFlag(int flag)
 {
     int flags, result;
 
-    flags = fcntl(gSockfd[gCurrent], F_GETFL, 0);
+    flags = fcntl(gSockets[gCurrent].fd, F_GETFL, 0);
     if (flags < 0){
         fprintf(stderr, "Error on F_GETFL - %s.\n", strerror(errno));
         return;
     }
     flags |= flag;
-    result = fcntl(gSockfd[gCurrent], F_SETFL, flags);
+    result = fcntl(gSockets[gCurrent].fd, F_SETFL, flags);
     if (result < 0){
         fprintf(stderr, "Error on F_SETFL - %s.\n", strerror(errno));
         return;
@@ -226,13 +576,13 @@ extern void clearFctlFlag(int flag)
 {
     int flags, result;
 
-    flags = fcntl(gSockfd[gCurrent], F_GETFL, 0);
+    flags = fcntl(gSockets[gCurrent].fd, F_GETFL, 0);
     if (flags < 0){
         fprintf(stderr, "Error on F_GETFL - %s.\n", strerror(errno));
         return;
     }
     flags &= ~flag;
-    result = fcntl(gSockfd[gCurrent], F_SETFL, flags);
+    result = fcntl(gSockets[gCurrent].fd, F_SETFL, flags);
     if (result < 0){
         fprintf(stderr, "Error on F_SETFL - %s.\n", strerror(errno));
         return;
@@ -240,40 +590,301 @@ extern void clearFctlFlag(int flag)
 }
 
 
-#define BLOCK_THRESHOLD   1000000      /*  Delay in us. that we will intepret as a block  */
+/*
+ *  Sockets are created nonblocking in the nonblocking model and blocking otherwise, so
+ *  O_NONBLOCK only has to change when a socket's model does.
+ */
+static int modelSocketFlags(enum model_enum model)
+{
+    return model == NONBLOCKING_MODEL ? SOCK_NONBLOCK : 0;
+}
+
+
+/*  Make O_NONBLOCK on the gCurrent socket match its model, calling fcntl() only if it must change.  */
+static void syncBlockingMode()
+{
+    int nonblocking = modelSocketFlags(gSockets[gCurrent].model) != 0;
+    
+    if (gSockets[gCurrent].fd == UNUSED_FD || gSockets[gCurrent].nonblocking == nonblocking)
+        return;
+    if (nonblocking)
+        setFctlFlag(O_NONBLOCK);
+    else
+        clearFctlFlag(O_NONBLOCK);
+    gSockets[gCurrent].nonblocking = nonblocking;
+}
+
+
+/*  Flags that keep a msg-based call from blocking in the nonblocking model, whatever the fd's mode.  */
+static int dontWaitFlag()
+{
+    return gSockets[gCurrent].model == NONBLOCKING_MODEL ? MSG_DONTWAIT : 0;
+}
+
+
+static __thread long long callTime;    /*  time at which API was called, in ns.  */
+static __thread long callSwitches;     /*  voluntary context switches when API was called  */
+static __thread long long gLastLatency; /*  time taken by the last API, in ns.  */
+static __thread int gBulk;             /*  In a bulk transfer, so don't check or report each API  */
+static __thread enum command_enum gCommand; /*  command being executed  */
+static __thread int gQuit = FALSE;       /*  quit has been run  */
+static struct nameIndex gCommandIndex;   /*  perfect hash over the command names  */
+
+
+/*
+ *  Latency histograms.  Values are recorded in log-linear buckets:  each power of two is
+ *  split into HIST_SUB_BUCKETS linear sub-buckets, so any value up to 2^63 is kept with a
+ *  relative error of at most 1/HIST_SUB_BUCKETS in a fixed amount of memory.  Histograms
+ *  with the same layout can be merged by adding their counts.
+ */
+#define HIST_SUB_BITS     5
+#define HIST_SUB_BUCKETS  (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS      ((64 - HIST_SUB_BITS) * HIST_SUB_BUCKETS)
+
+struct histogram {
+    long long count;                         /*  Values recorded  */
+    long long total;                         /*  Sum of the values recorded  */
+    long long min, max;
+    long long counts[HIST_BUCKETS];
+};
+
+
+/*  Empty a histogram.  */
+static void histReset(struct histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+
+/*  Return the bucket a (non-negative) value is counted in.  */
+static int histBucket(long long value)
+{
+    int msb;
+    
+    if (value < HIST_SUB_BUCKETS)
+        return value < 0 ? 0 : value;
+    msb = 63 - __builtin_clzll(value);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + 
+                (int)((value >> (msb - HIST_SUB_BITS)) - HIST_SUB_BUCKETS);
+}
+
+
+/*  Return the largest value counted in a bucket.  */
+static long long histBucketLimit(int bucket)
+{
+    int magnitude = bucket / HIST_SUB_BUCKETS;
+    long long sub = bucket % HIST_SUB_BUCKETS;
+    
+    if (magnitude == 0)
+        return sub;
+    return ((sub + HIST_SUB_BUCKETS + 1) << (magnitude - 1)) - 1;
+}
+
+
+/*  Record a value.  */
+static void histRecord(struct histogram *h, long long value)
+{
+    if (h->count == 0 || value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+    h->count++;
+    h->total += value;
+    h->counts[histBucket(value)]++;
+}
+
+
+/*  Add the values recorded in one histogram to another.  */
+static void histMerge(struct histogram *to, const struct histogram *from)
+{
+    int i;
+    
+    if (from->count == 0)
+        return;
+    if (to->count == 0 || from->min < to->min)
+        to->min = from->min;
+    if (from->max > to->max)
+        to->max = from->max;
+    to->count += from->count;
+    to->total += from->total;
+    for (i = 0; i < HIST_BUCKETS; i++)
+        to->counts[i] += from->counts[i];
+}
+
+
+/*  Return the value at or below which the given percentage of the recorded values fall.  */
+static long long histPercentile(const struct histogram *h, double percent)
+{
+    long long rank, seen = 0;
+    int i;
+    
+    if (h->count == 0)
+        return 0;
+    rank = (long long)(h->count * percent / 100.0 + 0.5);
+    rank = MAX(rank, 1);
+    for (i = 0; i < HIST_BUCKETS; i++){
+        seen += h->counts[i];
+        if (seen >= rank)
+            return MIN(histBucketLimit(i), h->max);
+    }
+    return h->max;
+}
+
+
+/*  Print the header for lines printed by histPrintLine().  */
+static void histPrintHeader(const char *label)
+{
+    printf("%-24s %10s %10s %10s %10s %10s %10s %10s %10s\n", label, "count", "min", "mean", "p50", 
+                "p99", "p99.9", "p99.99", "max");
+}
+
+
+/*  Print a one line summary of a histogram, in ns.  */
+static void histPrintLine(const char *label, const struct histogram *h)
+{
+    printf("%-24s %10lld %10lld %10lld %10lld %10lld %10lld %10lld %10lld\n", label, h->count, h->min, 
+                h->count ? h->total / h->count : 0, histPercentile(h, 50.0), histPercentile(h, 99.0), 
+                histPercentile(h, 99.9), histPercentile(h, 99.99), h->max);
+}
+
+
+/*  Print how the recorded values are distributed over powers of two.  */
+static void histPrintDistribution(const struct histogram *h)
+{
+    long long inRange;
+    int i, magnitude;
+    
+    for (magnitude = 0; magnitude * HIST_SUB_BUCKETS < HIST_BUCKETS; magnitude++){
+        inRange = 0;
+        for (i = magnitude * HIST_SUB_BUCKETS; i < (magnitude + 1) * HIST_SUB_BUCKETS; i++)
+            inRange += h->counts[i];
+        if (inRange != 0)
+            printf("  <= %12lld ns:  %10lld  %5.1f%%\n", histBucketLimit((magnitude + 1) * HIST_SUB_BUCKETS - 1), 
+                        inRange, 100.0 * inRange / h->count);
+    }
+}
+
+
+static __thread struct histogram *gHistograms[NUM_COMMANDS][NUM_MODELS];
+                                       /*  API latency of each command in each model, allocated on demand  */
+static __thread long gBlocked[NUM_COMMANDS][NUM_MODELS];
+                                       /*  Number of those APIs that blocked  */
+static __thread int gApiTimed;         /*  Has the command being executed timed an API?  */
+static struct histogram *gCommandTimes[NUM_COMMANDS];
+                                       /*  Run time of typed commands that time no API, allocated on demand  */
+
+/*  Return the histogram for a command in a model, allocating it the first time.  */
+static struct histogram *getHistogram(enum command_enum cmd, enum model_enum model)
+{
+    struct histogram **h = &gHistograms[cmd][model];
+    
+    if (*h == NULL){
+        *h = malloc(sizeof(**h));
+        if (*h == NULL)
+            return NULL;
+        histReset(*h);
+    }
+    return *h;
+}
+
+
+/*  Record the latency of an API called by the command being executed.  */
+static void recordLatency(enum model_enum model, long long latency, int blocked)
+{
+    struct histogram *h = getHistogram(gCommand, model);
+    
+    if (h == NULL)
+        return;
+    histRecord(h, latency);
+    gBlocked[gCommand][model] += blocked;
+    gApiTimed = TRUE;
+}
+
+
+/*  Read the high-resolution clock, in ns.  */
+static long long nowNs()
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/*  Return the number of times this thread has voluntarily given up the CPU.  */
+static long voluntarySwitches()
+{
+    struct rusage usage;
+    
+    if (getrusage(RUSAGE_THREAD, &usage) < 0)
+        return 0;
+    return usage.ru_nvcsw;
+}
 
-static struct timeval callTime;        /*  time at which API was called  */
 
 /*  Setup the mechanism used to determine if an API blocked.  */
 static void doBlockingSetup()
 {
-    gettimeofday(&callTime, NULL);
+    if (!gBulk)
+        callSwitches = voluntarySwitches();
+    callTime = nowNs();
 }
 
 
-/*  Determine if the API just called actually blocked.  */
+/*  Determine if the API just called actually blocked, and record how long it took.  */
 static void verifyBlocking(int expected)
 {
-    static struct timeval returnTime;
-    long delta;
+    long long returnTime;
+    long switches;
     int blocked;
 
     /* 
-     *  Heuristically (i.e. buggily) determine if the API
-     *  blocked by seeing how long it took to return.
+     *  The API blocked if the kernel switched us out voluntarily while it ran, 
+     *  which is what happens when a thread sleeps waiting for the socket.
      */
-    gettimeofday(&returnTime, NULL);
-    delta = (returnTime.tv_sec - callTime.tv_sec) * 1000000 + 
-                            returnTime.tv_usec - callTime.tv_usec;
-    blocked = delta > BLOCK_THRESHOLD;
+    returnTime = nowNs();
+    switches = gBulk ? 0 : voluntarySwitches() - callSwitches;
+    blocked = switches > 0;
+    
+    gLastLatency = returnTime - callTime;
+    recordLatency(gSockets[gCurrent].model, gLastLatency, blocked);
+    gSockets[gCurrent].apiCalls++;
+    gSockets[gCurrent].apiNs += gLastLatency;
+    
+    if (gBulk)
+        return;
     if (blocked != expected)
-        fprintf(stderr, "Error - API %s block.\n", blocked ? "did" : "did not");
+        fprintf(stderr, "Error - API %s block (%lld ns, %ld voluntary context switches).\n", 
+                    blocked ? "did" : "did not", gLastLatency, switches);
     else if (gVerbose)
-        fprintf(stderr, "API %s block.\n", blocked ? "did" : "did not");
+        fprintf(stderr, "API %s block (%lld ns, %ld voluntary context switches).\n", 
+                    blocked ? "did" : "did not", gLastLatency, switches);
 }
 
 
-static int shouldBlock;                         /*  Flag for blocking model special case  */
+static __thread int shouldBlock;                /*  Flag for blocking model special case  */
+static __thread readyCondition gNeededCondition;  /*  What the API being called needs to be ready for  */
+static __thread long long gTickNs = 1000000000LL; /*  How long a model waits before rechecking, in ns.  */
+
+
+/*  The tick as a timespec or timeval, for the calls that wait.  */
+static struct timespec tickTimespec()
+{
+    struct timespec ts;
+    
+    ts.tv_sec = gTickNs / 1000000000LL;
+    ts.tv_nsec = gTickNs % 1000000000LL;
+    return ts;
+}
+
+static struct timeval tickTimeval()
+{
+    struct timeval tv;
+    
+    tv.tv_sec = (gTickNs + 999) / 1000000000LL;
+    tv.tv_usec = ((gTickNs + 999) % 1000000000LL) / 1000;
+    return tv;
+}
 
 /*  Do setup for before we call a socket API in blocking model.  */
 static void blockingPreAPISetup(readyCondition neededCondition)
@@ -288,8 +899,6 @@ static void blockingPreAPISetup(readyCondition neededCondition)
 /*  Do setup for after we call a socket API in blocking model.  */
 static int blockingPostAPISetup(int apiResult)
 {
-    int blocked;
-    
     /*  Determine if we blocked in the API.  */
     verifyBlocking(shouldBlock && apiResult >= 0);   
     
@@ -297,17 +906,14 @@ static int blockingPostAPISetup(int apiResult)
 }
 
 
-/*  Do setup for before we call a socket API in nonblocking model.  */
+/*  Do setup for before we call a socket API in nonblocking model.  The socket is already nonblocking.  */
 static void nonblockingPreAPISetup()
 {
-    /*  Set up our blocking test.  */
-    doBlockingSetup();
-    
-    /*  Enable non-blocking model on the file descriptor.  */
-    setFctlFlag(O_NONBLOCK);
-
     if (gVerbose)
         printf("Tick.\n");
+
+    /*  Set up our blocking test.  */
+    doBlockingSetup();
 }
 
 
@@ -315,12 +921,11 @@ static void nonblockingPreAPISetup()
 static int nonblockingPostAPISetup(int apiResult)
 {
     int done, err = errno;
+    struct pollfd pfd;
+    struct timespec timeout;
     
     /*  Determine if we blocked in the API.  */
     verifyBlocking(FALSE);
-
-    /*  Disable non-blocking model on the file descriptor.  */
-    clearFctlFlag(O_NONBLOCK);
     
     done = apiResult >= 0 || ( err != EWOULDBLOCK && err != EINPROGRESS && err != EALREADY);
 
@@ -328,11 +933,23 @@ static int nonblockingPostAPISetup(int apiResult)
         if (apiResult != 0)
             printf("API result is %d, errno is '%s'.\n", apiResult, strerror(err));
         else
-            printf("API result is zero.\n", apiResult, strerror(err));
+            printf("API result is zero.\n");
     }
     
-    if (!done)
-        sleep(1);
+    /*  Wait (for up to a tick) until the socket is ready for the retry.  A connect in progress needs POLLOUT.  */
+    if (!done){
+        pfd.fd = gSockets[gCurrent].fd;
+        switch (gNeededCondition){
+            case READ_READY:    pfd.events = POLLIN;     break;
+            case WRITE_READY:   pfd.events = POLLOUT;    break;
+            case EXCEPT_READY:  pfd.events = POLLPRI;    break;
+        }
+        if (err == EINPROGRESS || err == EALREADY)
+            pfd.events = POLLOUT;
+        timeout = tickTimespec();
+        if (ppoll(&pfd, 1, &timeout, NULL) == 0 && gVerbose)
+            printf("Tick.\n");
+    }
 
     return done;
 }
@@ -355,6 +972,13 @@ static void selectPreAPISetup(readyCondition neededCondition)
         case EXCEPT_READY:  watchBits = &exceptBits;  break;
     }
     
+    /*  select() can't watch the high-numbered fds a large socket table hands out.  */
+    if (gSockets[gCurrent].fd >= FD_SETSIZE){
+        fprintf(stderr, "Error - fd %d is too large for select(); use the epoll model.\n", gSockets[gCurrent].fd);
+        doBlockingSetup();
+        return;
+    }
+    
     /*  Loop doing the select.  */
     do {
         /*  Initialize the bit sets.  */
@@ -362,19 +986,18 @@ static void selectPreAPISetup(readyCondition neededCondition)
         FD_ZERO(&writeBits);
         FD_ZERO(&exceptBits);
 
-        FD_SET(gSockfd[gCurrent], watchBits);
+        FD_SET(gSockets[gCurrent].fd, watchBits);
    
         /*  Initialize the timeout.  */
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+        timeout = tickTimeval();
         
         /*  Do the select() and check its output.  */
-        result = select(gSockfd[gCurrent]+1, &readBits, &writeBits, &exceptBits, &timeout);
+        result = select(gSockets[gCurrent].fd+1, &readBits, &writeBits, &exceptBits, &timeout);
         if (result == 0){
             if (gVerbose)
                 printf("Tick.\n");
         } else if (result == 1){
-            if (!FD_ISSET(gSockfd[gCurrent], watchBits))
+            if (!FD_ISSET(gSockets[gCurrent].fd, watchBits))
                 fprintf(stderr, "Error - Expected fd bit not set after select() returned 1.\n");
             else
                 if (gVerbose)
@@ -393,6 +1016,8 @@ static void selectPreAPISetup(readyCondition neededCondition)
 /*  Do setup for after we call a socket API in select model.  */
 static int selectPostAPISetup(int apiResult)
 {
+    (void) apiResult;
+    
     /*  Determine if we blocked in the API.  */
     verifyBlocking(FALSE);   
     
@@ -403,6 +1028,7 @@ static int selectPostAPISetup(int apiResult)
 /*  This SIGIO handler is used when we do not expect a SIGIO signal.  */
 static void defaultSIGIOHandler(int sig)
 {
+    (void) sig;
     fprintf(stderr, "Error - Unexpected SIGIO signal.\n");
 }
 
@@ -411,7 +1037,8 @@ static int sigioReceived;                    /*  Flag from sig handler to main p
 
 /*  This SIGIO handler is used when we expect a SIGIO signal.  */
 static void activeSIGIOHandler(int sig)
-{    
+{
+    (void) sig;
     sigioReceived = TRUE;
     
     if (gVerbose)
@@ -426,6 +1053,8 @@ static void activeSIGIOHandler(int sig)
 static void signalPreAPISetup(readyCondition neededCondition)
 {
     sighandler_t sigResult;
+    sigset_t sigio, original, waitMask;
+    struct timespec timeout;
     int result;
     
     /*  
@@ -446,22 +1075,31 @@ static void signalPreAPISetup(readyCondition neededCondition)
         fprintf(stderr, "Error - signal() returned SIG_ERR.\n");
         return;
     }
-    result = fcntl(gSockfd[gCurrent], F_SETOWN, getpid());
+    result = fcntl(gSockets[gCurrent].fd, F_SETOWN, getpid());
     if (result < 0){
         fprintf(stderr, "Error on F_SETOWN - %s.\n", strerror(errno));
         return;
     }
     
-    /*  Enable signal model on the file descriptor.  */
+    /*  
+     *  Enable signal model on the file descriptor, with SIGIO held off until ppoll() 
+     *  atomically lets it in, so one arriving just before the wait isn't missed.
+     */
+    sigemptyset(&sigio);
+    sigaddset(&sigio, SIGIO);
+    pthread_sigmask(SIG_BLOCK, &sigio, &original);
+    waitMask = original;
+    sigdelset(&waitMask, SIGIO);             /*  The rtsignal model may have left it blocked  */
     sigioReceived = FALSE;
     setFctlFlag(O_ASYNC);
 
-    /*  Loop until the SIGIO occurs.  */
+    /*  Wait until the SIGIO occurs.  */
     while (!sigioReceived && !gInterrupted){
-        sleep(1);
-        if (gVerbose)
+        timeout = tickTimespec();
+        if (ppoll(NULL, 0, &timeout, &waitMask) == 0 && gVerbose)
             printf("Tick.\n");
     }
+    pthread_sigmask(SIG_SETMASK, &original, NULL);
 
     /*  Set up our blocking test.  */
     doBlockingSetup();
@@ -471,6 +1109,8 @@ static void signalPreAPISetup(readyCondition neededCondition)
 /*  Do setup for after we call a socket API in signal model.  */
 static int signalPostAPISetup(int apiResult)
 {
+    (void) apiResult;
+    
     sighandler_t sigResult;    
     
     /*  Determine if we blocked in the API.  */
@@ -480,7 +1120,7 @@ static int signalPostAPISetup(int apiResult)
     sigResult = signal(SIGIO, defaultSIGIOHandler);
     if (sigResult == SIG_ERR){
         fprintf(stderr, "Error - signal() returned SIG_ERR.\n");
-        return;
+        return TRUE;
     }
 
     /*  Disable signal model on the file descriptor.  */
@@ -491,12 +1131,670 @@ static int signalPostAPISetup(int apiResult)
 
 
 /*
- *  Do common setup for before we call a socket API.  neededCondition indicates
- *  what condition the socket has to be ready for before we can call the API.
+ *  Realtime signal model.  Instead of SIGIO and a handler, each socket is set up with
+ *  F_SETSIG to queue RTSIGNAL, with its siginfo, at the thread using it (F_SETOWN_EX), 
+ *  and the thread reads the siginfo from a signalfd.  Signals queue, so none are lost, 
+ *  and each says which fd became ready and why (its band, as poll() events).  As the 
+ *  signal goes to a thread rather than the process, workers can use this model.
  */
-static void preAPISetup(readyCondition neededCondition)
-{
-    switch (model){
+#define RTSIGNAL  (SIGRTMIN + 1)
+
+static __thread int gSignalFd = UNUSED_FD;       /*  signalfd reading RTSIGNAL  */
+static __thread struct histogram *gSignalLatency;
+                                                 /*  From the last send to its signal being read  */
+
+
+/*  Describe a band of poll() events.  */
+static char *bandString(long band, char *buffer, size_t size)
+{
+    snprintf(buffer, size, "%s%s%s%s%s", band & POLLIN ? "POLLIN " : "", band & POLLOUT ? "POLLOUT " : "",
+                band & POLLPRI ? "POLLPRI " : "", band & POLLERR ? "POLLERR " : "", 
+                band & POLLHUP ? "POLLHUP " : "");
+    if (*buffer != 0)
+        buffer[strlen(buffer) - 1] = 0;
+    return buffer;
+}
+
+
+/*  Set the gCurrent socket up to queue RTSIGNAL at this thread, or stop it doing so.  */
+static int rtsignalArm(int arm)
+{
+    struct f_owner_ex owner;
+    sigset_t mask;
+    
+    if (gSockets[gCurrent].rtsignalArmed == arm || gSockets[gCurrent].fd == UNUSED_FD)
+        return 0;
+    if (!arm){
+        clearFctlFlag(O_ASYNC);
+        (void) fcntl(gSockets[gCurrent].fd, F_SETSIG, 0);
+        (void) fcntl(gSockets[gCurrent].fd, F_SETOWN, 0);
+        gSockets[gCurrent].rtsignalArmed = FALSE;
+        return 0;
+    }
+    
+    /*  
+     *  The thread's signalfd.  RTSIGNAL is blocked so it is only ever read from there.  So
+     *  is SIGIO, which the kernel sends instead when the realtime signal queue overflows.
+     */
+    if (gSignalFd == UNUSED_FD){
+        sigemptyset(&mask);
+        sigaddset(&mask, RTSIGNAL);
+        sigaddset(&mask, SIGIO);
+        pthread_sigmask(SIG_BLOCK, &mask, NULL);
+        gSignalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (gSignalFd < 0){
+            fprintf(stderr, "Error on signalfd() - %s.\n", strerror(errno));
+            gSignalFd = UNUSED_FD;
+            return -1;
+        }
+    }
+    
+    owner.type = F_OWNER_TID;
+    owner.pid = gettid();
+    if (fcntl(gSockets[gCurrent].fd, F_SETSIG, RTSIGNAL) < 0 || 
+            fcntl(gSockets[gCurrent].fd, F_SETOWN_EX, &owner) < 0){
+        fprintf(stderr, "Error on F_SETSIG/F_SETOWN_EX - %s.\n", strerror(errno));
+        return -1;
+    }
+    setFctlFlag(O_ASYNC);
+    gSockets[gCurrent].rtsignalArmed = TRUE;
+    return 0;
+}
+
+
+/*
+ *  Read the queued signals, returning TRUE if one says the gCurrent socket is ready for
+ *  any of the events given.  Signals for sockets closed since are skipped.
+ */
+static int rtsignalRead(short events)
+{
+    struct signalfd_siginfo info;
+    struct histogram **latency = &gSignalLatency;
+    struct pollfd pfd;
+    long long sent, now;
+    char band[64];
+    int ready = FALSE;
+    
+    while (read(gSignalFd, &info, sizeof(info)) == sizeof(info)){
+        
+        /*  Signals were lost, so look at the socket itself.  */
+        if (info.ssi_signo == SIGIO){
+            fprintf(stderr, "Error - the realtime signal queue overflowed.\n");
+            pfd.fd = gSockets[gCurrent].fd;
+            pfd.events = events;
+            if (poll(&pfd, 1, 0) > 0)
+                ready = TRUE;
+            continue;
+        }
+        if (info.ssi_fd != gSockets[gCurrent].fd || !(info.ssi_band & (events | POLLERR | POLLHUP))){
+            if (gVerbose)
+                printf("Skipped signal for fd %d, band %s.\n", info.ssi_fd, 
+                            bandString(info.ssi_band, band, sizeof(band)));
+            continue;
+        }
+        
+        /*  Measure from the last send, when there was one, to the signal being read.  */
+        now = nowNs();
+        sent = __atomic_load_n(&gLastSendNs, __ATOMIC_RELAXED);
+        if (!ready && sent != 0 && sent <= now){
+            if (*latency == NULL && (*latency = malloc(sizeof(**latency))) != NULL)
+                histReset(*latency);
+            if (*latency != NULL)
+                histRecord(*latency, now - sent);
+        }
+        if (!gBulk)
+            printf("Signal %d:  fd %d ready, band %s, %lld ns after the last send.\n", info.ssi_signo, 
+                        info.ssi_fd, bandString(info.ssi_band, band, sizeof(band)), sent ? now - sent : 0);
+        ready = TRUE;
+    }
+    return ready;
+}
+
+
+/*  Do setup for before we call a socket API in realtime signal model.  */
+static void rtsignalPreAPISetup(readyCondition neededCondition)
+{
+    struct pollfd pfd[2];
+    struct timespec timeout;
+    short events;
+    
+    switch (neededCondition){
+        case READ_READY:    events = POLLIN;     break;
+        case WRITE_READY:   events = POLLOUT;    break;
+        case EXCEPT_READY:  events = POLLPRI;    break;
+    }
+    if (rtsignalArm(TRUE) < 0){
+        doBlockingSetup();
+        return;
+    }
+    
+    /*  
+     *  As in the signal model, writes are assumed to be ready.  Otherwise use up the
+     *  signals already queued, and if none says the socket is ready, check it hasn't been
+     *  ready since before it raised a signal, and wait for one.
+     */
+    if (neededCondition != WRITE_READY && !rtsignalRead(events)){
+        pfd[0].fd = gSockets[gCurrent].fd;
+        pfd[0].events = events;
+        if (poll(pfd, 1, 0) == 0){
+            pfd[0].fd = gSignalFd;
+            pfd[0].events = POLLIN;
+            while (!gInterrupted){
+                timeout = tickTimespec();
+                if (ppoll(pfd, 1, &timeout, NULL) == 0){
+                    if (gVerbose)
+                        printf("Tick.\n");
+                } else if (rtsignalRead(events))
+                    break;
+            }
+        }
+    }
+
+    /*  Set up our blocking test.  */
+    doBlockingSetup();
+}
+
+
+#define MAX_EPOLL_EVENTS  16                     /*  Events harvested per epoll_wait()  */
+
+static __thread int gEpollFd = UNUSED_FD;        /*  Persistent epoll instance  */
+
+/*  Forget any epoll registration of a socket slot that is about to be closed.  */
+static void epollForget(int slot)
+{
+    if (gEpollFd != UNUSED_FD && gSockets[slot].epollEvents != 0)
+        (void) epoll_ctl(gEpollFd, EPOLL_CTL_DEL, gSockets[slot].fd, NULL);
+    gSockets[slot].epollEvents = 0;
+    gSockets[slot].epollReady = 0;
+}
+
+
+/*  Make sure the gCurrent socket is registered with the epoll instance for the given events.  */
+static int epollRegister(unsigned events)
+{
+    struct epoll_event ev;
+    int result;
+    
+    if (gSockets[gCurrent].epollEvents == events)
+        return 0;
+
+    ev.events = events;
+    ev.data.u32 = gCurrent;
+    result = epoll_ctl(gEpollFd, gSockets[gCurrent].epollEvents == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, 
+                        gSockets[gCurrent].fd, &ev);
+    if (result < 0){
+        fprintf(stderr, "Error on epoll_ctl() - %s.\n", strerror(errno));
+        return -1;
+    }
+    gSockets[gCurrent].epollEvents = events;
+    return 0;
+}
+
+
+/*
+ *  Do setup for before we call a socket API in epoll model.  neededCondition indicates
+ *  what condition the socket has to be ready for before we can call the API.
+ *
+ *  The epoll instance persists across calls, so a socket is only re-registered when the
+ *  condition it is waited on changes.  In level-triggered mode the socket is registered 
+ *  for just the needed condition.  In edge-triggered mode it is registered once for all
+ *  conditions, and each reported edge is remembered until an API call consumes it.  As
+ *  in any edge-triggered event loop, an API that does not drain the socket will not be 
+ *  woken again until new data arrives.
+ */
+static void epollPreAPISetup(readyCondition neededCondition, int edgeTriggered)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    struct timespec timeout;
+    unsigned watchEvent;
+    int i, slot, result, done;
+    
+    /*  Determine which event we expect.  */
+    switch (neededCondition){
+        case READ_READY:    watchEvent = EPOLLIN;     break;
+        case WRITE_READY:   watchEvent = EPOLLOUT;    break;
+        case EXCEPT_READY:  watchEvent = EPOLLPRI;    break;
+    }
+    
+    /*  Create the epoll instance the first time through.  */
+    if (gEpollFd == UNUSED_FD){
+        gEpollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (gEpollFd < 0){
+            fprintf(stderr, "Error on epoll_create1() - %s.\n", strerror(errno));
+            gEpollFd = UNUSED_FD;
+        }
+    }
+    
+    /*  Register (or re-register) the socket if needed.  Failing that, just call the API.  */
+    if (gEpollFd == UNUSED_FD)
+        result = -1;
+    else if (edgeTriggered)
+        result = epollRegister(EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLET);
+    else
+        result = epollRegister(watchEvent);
+        
+    /*  Loop doing the epoll_wait(), unless we already hold an unconsumed edge.  */
+    done = result < 0 || (edgeTriggered && (gSockets[gCurrent].epollReady & (watchEvent | EPOLLERR | EPOLLHUP)));
+    while (!done && !gInterrupted){
+        timeout = tickTimespec();
+        result = epoll_pwait2(gEpollFd, events, MAX_EPOLL_EVENTS, &timeout, NULL);
+        if (result < 0 && errno == ENOSYS)
+            result = epoll_wait(gEpollFd, events, MAX_EPOLL_EVENTS, (gTickNs + 999999) / 1000000);
+        if (result == 0){
+            if (gVerbose)
+                printf("Tick.\n");
+        } else if (result < 0 && errno != EINTR){
+            
+            /*  Waiting again would fail again.  Let the API call report what's wrong.  */
+            fprintf(stderr, "Error - epoll_wait() returned %d - %s.\n", result, strerror(errno));
+            done = TRUE;
+        }
+        
+        for (i = 0; i < result; i++){
+            slot = events[i].data.u32;
+            if (edgeTriggered)
+                gSockets[slot].epollReady |= events[i].events;
+            else if (slot != gCurrent){
+                /*  Disarm other level-triggered sockets so they don't spin us.  */
+                (void) epoll_ctl(gEpollFd, EPOLL_CTL_DEL, gSockets[slot].fd, NULL);
+                gSockets[slot].epollEvents = 0;
+            }
+            if (slot == gCurrent && (events[i].events & (watchEvent | EPOLLERR | EPOLLHUP))){
+                if (gVerbose)
+                    printf("epoll_wait() exited as expected.\n");
+                done = TRUE;
+            }
+        }
+    }
+    
+    /*  Consume the edge.  */
+    gSockets[gCurrent].epollReady &= ~(watchEvent | EPOLLERR | EPOLLHUP);
+
+    /*  Set up our blocking test.  */
+    doBlockingSetup();
+}
+
+
+#define IOURING_ENTRIES   64                     /*  Submission queue depth  */
+#define IOBUFFER_SIZE     (64*1024)              /*  Size of the (registerable) I/O buffer  */
+#define RING_FILE_SLOTS   1024                   /*  Size of the sparse fixed file table  */
+
+static __thread struct {
+    int fd;                                      /*  io_uring instance, UNUSED_FD if none  */
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    int batch;                                   /*  SQEs submitted per write-side command  */
+    int fixedFiles;                              /*  Use the registered file table?  */
+    int fixedBuffers;                            /*  Use the registered I/O buffer?  */
+    int filesRegistered, buffersRegistered;
+    long enters, ops;                            /*  io_uring_enter() calls and operations completed  */
+    unsigned prepared;                           /*  SQEs prepared for the next submission  */
+    char *sqRing, *cqRing;                       /*  Mappings, kept so they can be undone  */
+    size_t sqRingSize, cqRingSize, sqesSize;
+} gRing = {.fd = UNUSED_FD};
+static __thread int gRingFiles[RING_FILE_SLOTS]; /*  fd registered at each fixed file index, or -1  */
+static __thread char gIOBuffer[IOBUFFER_SIZE];   /*  Buffer used by read and write  */
+
+
+static void uringTeardown();
+
+/*  Create the io_uring instance and map its rings.  */
+static int uringSetup()
+{
+    struct io_uring_params params;
+    char *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize;
+    
+    memset(&params, 0, sizeof(params));
+    gRing.fd = syscall(__NR_io_uring_setup, IOURING_ENTRIES, &params);
+    if (gRing.fd < 0){
+        fprintf(stderr, "Error on io_uring_setup() - %s.\n", strerror(errno));
+        gRing.fd = UNUSED_FD;
+        return -1;
+    }
+    
+    /*  Map the submission and completion rings.  */
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sqRingSize = cqRingSize = MAX(sqRingSize, cqRingSize);
+    sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+                    gRing.fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED){
+        fprintf(stderr, "Error mapping submission ring - %s.\n", strerror(errno));
+        uringTeardown();
+        return -1;
+    }
+    gRing.sqRing = sqRing;
+    gRing.sqRingSize = sqRingSize;
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        cqRing = sqRing;
+    else {
+        cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+                        gRing.fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED){
+            fprintf(stderr, "Error mapping completion ring - %s.\n", strerror(errno));
+            uringTeardown();
+            return -1;
+        }
+    }
+    gRing.cqRing = cqRing;
+    gRing.cqRingSize = cqRingSize;
+    gRing.sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    gRing.sqes = mmap(NULL, gRing.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+                        gRing.fd, IORING_OFF_SQES);
+    if (gRing.sqes == MAP_FAILED){
+        fprintf(stderr, "Error mapping submission queue entries - %s.\n", strerror(errno));
+        gRing.sqes = NULL;
+        uringTeardown();
+        return -1;
+    }
+    
+    gRing.sqHead = (unsigned *)(sqRing + params.sq_off.head);
+    gRing.sqTail = (unsigned *)(sqRing + params.sq_off.tail);
+    gRing.sqMask = (unsigned *)(sqRing + params.sq_off.ring_mask);
+    gRing.sqArray = (unsigned *)(sqRing + params.sq_off.array);
+    gRing.cqHead = (unsigned *)(cqRing + params.cq_off.head);
+    gRing.cqTail = (unsigned *)(cqRing + params.cq_off.tail);
+    gRing.cqMask = (unsigned *)(cqRing + params.cq_off.ring_mask);
+    gRing.cqes = (struct io_uring_cqe *)(cqRing + params.cq_off.cqes);
+    
+    return 0;
+}
+
+
+/*  Unmap whatever rings are mapped and close the io_uring instance, if there is one.  */
+static void uringTeardown()
+{
+    if (gRing.fd == UNUSED_FD)
+        return;
+    if (gRing.sqes != NULL)
+        (void) munmap(gRing.sqes, gRing.sqesSize);
+    if (gRing.cqRing != NULL && gRing.cqRing != gRing.sqRing)
+        (void) munmap(gRing.cqRing, gRing.cqRingSize);
+    if (gRing.sqRing != NULL)
+        (void) munmap(gRing.sqRing, gRing.sqRingSize);
+    (void) close(gRing.fd);
+    gRing.fd = UNUSED_FD;
+    gRing.sqes = NULL;
+    gRing.sqRing = gRing.cqRing = NULL;
+    gRing.filesRegistered = gRing.buffersRegistered = FALSE;
+}
+
+
+/*  Register or unregister the fixed file table and I/O buffer to match the model options.  */
+static int uringRegister()
+{
+    struct iovec iov;
+    int i, result;
+    
+    if (gRing.fixedFiles && !gRing.filesRegistered){
+        for (i = 0; i < RING_FILE_SLOTS; i++)
+            gRingFiles[i] = -1;
+        result = syscall(__NR_io_uring_register, gRing.fd, IORING_REGISTER_FILES, gRingFiles, RING_FILE_SLOTS);
+        if (result < 0){
+            fprintf(stderr, "Error registering files - %s.\n", strerror(errno));
+            return -1;
+        }
+        gRing.filesRegistered = TRUE;
+    } else if (!gRing.fixedFiles && gRing.filesRegistered){
+        (void) syscall(__NR_io_uring_register, gRing.fd, IORING_UNREGISTER_FILES, NULL, 0);
+        gRing.filesRegistered = FALSE;
+    }
+    
+    if (gRing.fixedBuffers && !gRing.buffersRegistered){
+        iov.iov_base = gIOBuffer;
+        iov.iov_len = sizeof(gIOBuffer);
+        result = syscall(__NR_io_uring_register, gRing.fd, IORING_REGISTER_BUFFERS, &iov, 1);
+        if (result < 0){
+            fprintf(stderr, "Error registering buffers - %s.\n", strerror(errno));
+            return -1;
+        }
+        gRing.buffersRegistered = TRUE;
+    } else if (!gRing.fixedBuffers && gRing.buffersRegistered){
+        (void) syscall(__NR_io_uring_register, gRing.fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        gRing.buffersRegistered = FALSE;
+    }
+    
+    return 0;
+}
+
+
+/*  Drop a socket that is about to be closed from the fixed file table.  */
+static void uringForget(int fd)
+{
+    struct io_uring_files_update update;
+    int unused = -1;
+    
+    if (!gRing.filesRegistered || fd < 0 || fd >= RING_FILE_SLOTS || gRingFiles[fd] < 0)
+        return;
+    memset(&update, 0, sizeof(update));
+    update.offset = fd;
+    update.fds = (unsigned long)&unused;
+    (void) syscall(__NR_io_uring_register, gRing.fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+    gRingFiles[fd] = -1;
+}
+
+
+/*  Get and initialize the next SQE for an operation on fd.  */
+static struct io_uring_sqe *uringPrep(int opcode, int fd, const void *addr, unsigned len, __u64 off)
+{
+    struct io_uring_files_update update;
+    struct io_uring_sqe *sqe;
+    unsigned tail = *gRing.sqTail;
+    unsigned index = tail & *gRing.sqMask;
+    
+    sqe = &gRing.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = ++gRing.prepared;
+    
+    /*  Refer to the socket through the fixed file table when we can.  */
+    if (gRing.filesRegistered && fd >= 0 && fd < RING_FILE_SLOTS){
+        if (gRingFiles[fd] != fd){
+            memset(&update, 0, sizeof(update));
+            update.offset = fd;
+            update.fds = (unsigned long)&fd;
+            if (syscall(__NR_io_uring_register, gRing.fd, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1)
+                gRingFiles[fd] = fd;
+        }
+        if (gRingFiles[fd] == fd)
+            sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    
+    gRing.sqArray[index] = index;
+    __atomic_store_n(gRing.sqTail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+
+/*  
+ *  Reap the CQEs that have arrived, marking their operations done and adding up their
+ *  results.  The CQEs of cancellations (user_data 0) are consumed but not counted.  Returns
+ *  the number of operations reaped.
+ */
+static int uringReap(char done[], int *total, int *err)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head;
+    int reaped = 0;
+    
+    head = *gRing.cqHead;
+    while (head != __atomic_load_n(gRing.cqTail, __ATOMIC_ACQUIRE)){
+        cqe = &gRing.cqes[head & *gRing.cqMask];
+        if (cqe->user_data != 0 && cqe->user_data <= IOURING_ENTRIES){
+            done[cqe->user_data] = TRUE;
+            if (cqe->res < 0 && *err == 0)
+                *err = -cqe->res;
+            else if (cqe->res > 0)
+                *total += cqe->res;
+            reaped++;
+        }
+        head++;
+    }
+    __atomic_store_n(gRing.cqHead, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+
+/*
+ *  Submit count prepared SQEs with a single io_uring_enter() and reap their CQEs.  Returns
+ *  the sum of the results, or -1 with errno set from the first operation that failed.
+ *  If io_uring_enter() fails or we are interrupted part way, the SQEs the kernel hasn't
+ *  taken are withdrawn and the rest cancelled and reaped, so none complete later (into a
+ *  buffer that may be reused) and get counted towards the next operation.
+ */
+static int uringSubmitAndWait(int count)
+{
+    char done[IOURING_ENTRIES + 1];
+    unsigned pending;
+    int result, i, reaped = 0, total = 0, err = 0, enterErr = 0, outstanding;
+    
+    memset(done, 0, sizeof(done));
+    do {
+        result = syscall(__NR_io_uring_enter, gRing.fd, reaped == 0 ? count : 0, count - reaped, 
+                            IORING_ENTER_GETEVENTS, NULL, 0);
+        gRing.enters++;
+        if (result < 0 && errno != EINTR){
+            enterErr = errno;
+            break;
+        }
+        reaped += uringReap(done, &total, &err);
+    } while (reaped < count && !gInterrupted);
+    gRing.ops += reaped;
+    
+    if (reaped < count){
+        
+        /*  Withdraw what was never submitted.  They were prepared last.  */
+        pending = *gRing.sqTail - __atomic_load_n(gRing.sqHead, __ATOMIC_ACQUIRE);
+        __atomic_store_n(gRing.sqTail, *gRing.sqTail - pending, __ATOMIC_RELEASE);
+        for (i = count - pending + 1; i <= count; i++)
+            done[i] = TRUE;
+        
+        /*  Cancel the rest, and wait for them all to finish.  */
+        for (i = 1, outstanding = 0; i <= count; i++){
+            if (!done[i]){
+                uringPrep(IORING_OP_ASYNC_CANCEL, -1, (void *)(unsigned long) i, 0, 0)->user_data = 0;
+                outstanding++;
+            }
+        }
+        for (i = outstanding; outstanding > 0; i = 0){
+            result = syscall(__NR_io_uring_enter, gRing.fd, i, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (result < 0 && errno != EINTR)
+                break;
+            outstanding -= uringReap(done, &total, &err);
+        }
+        err = enterErr ? enterErr : gInterrupted ? EINTR : err;
+    }
+    gRing.prepared = 0;
+    
+    if (gVerbose)
+        printf("%d io_uring operations completed, %ld operations in %ld io_uring_enter() calls so far.\n", 
+                    reaped, gRing.ops, gRing.enters);
+    
+    if (err != 0){
+        errno = err;
+        return -1;
+    }
+    return total;
+}
+
+
+/*  Return the opcode to use for a read or write of buf, switching to the fixed variant if registered.  */
+static int uringBufferOpcode(int opcode, const void *buf, size_t len)
+{
+    if (gRing.buffersRegistered && (const char *)buf >= gIOBuffer && 
+                (const char *)buf + len <= gIOBuffer + sizeof(gIOBuffer))
+        return opcode == IORING_OP_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+    return opcode;
+}
+
+
+/*  The socket APIs used by the data commands, issued through io_uring in that model.  */
+static ssize_t apiRead(int fd, void *buf, size_t len)
+{
+    if (gSockets[gCurrent].model != IOURING_MODEL)
+        return read(fd, buf, len);
+    uringPrep(uringBufferOpcode(IORING_OP_READ, buf, len), fd, buf, len, -1);
+    return uringSubmitAndWait(1);
+}
+
+
+static ssize_t apiWrite(int fd, const void *buf, size_t len)
+{
+    int i, opcode;
+    
+    if (gSockets[gCurrent].model != IOURING_MODEL)
+        return write(fd, buf, len);
+    opcode = uringBufferOpcode(IORING_OP_WRITE, buf, len);
+    for (i = 0; i < gRing.batch; i++)
+        uringPrep(opcode, fd, buf, len, -1);
+    return uringSubmitAndWait(gRing.batch);
+}
+
+
+static ssize_t apiSend(int fd, const void *buf, size_t len, int flags)
+{
+    if (gSockets[gCurrent].model != IOURING_MODEL)
+        return send(fd, buf, len, flags | dontWaitFlag());
+    uringPrep(IORING_OP_SEND, fd, buf, len, 0)->msg_flags = flags;
+    return uringSubmitAndWait(1);
+}
+
+
+static int apiAccept(int fd, struct sockaddr *addr, socklen_t *len, int flags)
+{
+    if (gSockets[gCurrent].model != IOURING_MODEL)
+        return accept4(fd, addr, len, flags);
+    uringPrep(IORING_OP_ACCEPT, fd, addr, 0, (unsigned long)len)->accept_flags = flags;
+    return uringSubmitAndWait(1);
+}
+
+
+static int apiConnect(int fd, const struct sockaddr *addr, socklen_t len)
+{
+    if (gSockets[gCurrent].model != IOURING_MODEL)
+        return connect(fd, addr, len);
+    uringPrep(IORING_OP_CONNECT, fd, addr, 0, len);
+    return uringSubmitAndWait(1);
+}
+
+
+static ssize_t apiSendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    int i;
+    
+    if (gSockets[gCurrent].model != IOURING_MODEL)
+        return sendmsg(fd, msg, flags | dontWaitFlag());
+    for (i = 0; i < gRing.batch; i++)
+        uringPrep(IORING_OP_SENDMSG, fd, msg, 1, 0)->msg_flags = flags;
+    return uringSubmitAndWait(gRing.batch);
+}
+
+
+static ssize_t apiRecvmsg(int fd, struct msghdr *msg, int flags)
+{
+    if (gSockets[gCurrent].model != IOURING_MODEL)
+        return recvmsg(fd, msg, flags | dontWaitFlag());
+    uringPrep(IORING_OP_RECVMSG, fd, msg, 1, 0)->msg_flags = flags;
+    return uringSubmitAndWait(1);
+}
+
+
+/*
+ *  Do common setup for before we call a socket API.  neededCondition indicates
+ *  what condition the socket has to be ready for before we can call the API.
+ */
+static void preAPISetup(readyCondition neededCondition)
+{
+    gNeededCondition = neededCondition;
+    switch (gSockets[gCurrent].model){
         case BLOCKING_MODEL:
         default:
             blockingPreAPISetup(neededCondition);
@@ -510,6 +1808,18 @@ static void preAPISetup(readyCondition neededCondition)
         case SIGNAL_MODEL:
             signalPreAPISetup(neededCondition);
             break;
+        case EPOLL_MODEL:
+            epollPreAPISetup(neededCondition, FALSE);
+            break;
+        case EPOLLET_MODEL:
+            epollPreAPISetup(neededCondition, TRUE);
+            break;
+        case IOURING_MODEL:
+            blockingPreAPISetup(neededCondition);
+            break;
+        case RTSIGNAL_MODEL:
+            rtsignalPreAPISetup(neededCondition);
+            break;
     }
 }
 
@@ -522,7 +1832,10 @@ static int postAPISetup(int apiResult)
 {
     int done;
     
-    switch (model){
+    if (apiResult < 0)
+        gSockets[gCurrent].apiErrors++;
+
+    switch (gSockets[gCurrent].model){
         case BLOCKING_MODEL:
         default:
             done = blockingPostAPISetup(apiResult);
@@ -531,791 +1844,3642 @@ static int postAPISetup(int apiResult)
             done = nonblockingPostAPISetup(apiResult);
             break;
         case SELECT_MODEL:
+        case EPOLL_MODEL:
+        case EPOLLET_MODEL:
+        case RTSIGNAL_MODEL:
             done = selectPostAPISetup(apiResult);
             break;
         case SIGNAL_MODEL:
             done = signalPostAPISetup(apiResult);
             break;
+        case IOURING_MODEL:
+            done = blockingPostAPISetup(apiResult);
+            break;
     }
     
+    /*  Note when data was last sent, so signal delivery latency can be measured.  */
+    if (gNeededCondition == WRITE_READY && apiResult >= 0)
+        __atomic_store_n(&gLastSendNs, nowNs(), __ATOMIC_RELAXED);
+    
     return done;
 }
 
 
-/*
- *  Implement help command.
- *
- *  model 
- *
- */
-static void doHelp()
+/*
+ *  Implement help command.
+ *
+ *  model 
+ *
+ */
+static void doHelp()
+{
+    enum command_enum i;
+    
+    printf("socktest understands these gCommands:\n");
+    for (i =  CMD_QUIT; i < NUM_COMMANDS; i ++)
+        printf("  %s\n", gCommandTable[i].usage);
+}
+
+
+/*
+ *  Implement model command.
+ *
+ *  model *blocking | nonblocking | select | signal | rtsignal | epoll | epollet | iouring [-b batch] [-f] [-r] [-t timeout]
+ *
+ *  In the iouring model, -b submits each write-side operation batch times with a single 
+ *  io_uring_enter(), -f refers to sockets through registered (fixed) files and -r does 
+ *  read and write through a registered buffer.
+ *
+ *  rtsignal is the signal model with a queued realtime signal per socket, read from a 
+ *  signalfd, showing which socket became ready and the signal delivery latency.
+ *
+ *  -t sets how long the nonblocking, select, signal, rtsignal and epoll models wait for readiness
+ *  before checking for an interrupt and waiting again (default 1s).  It can be well under
+ *  a millisecond, or 0 to spin.
+ */
+static void doModel()
+{
+    int retval = 0, iouring, batch = 1, fixedFiles = FALSE, fixedBuffers = FALSE;
+    long long tickNs = gTickNs;
+    enum model_enum model;
+    char option;
+
+    /*  Process model options.  Only -t applies to every model.  */
+    iouring = gTokens[1] != NULL && strcasecmp(gTokens[1], "iouring") == 0;
+    gOptind = 0;
+    while (retval == 0 && (option = getOption(gTokenCount - 1, &gTokens[1], "b:frt:")) != -1){
+        switch (option){
+            case 'b':
+                retval = setIntegerArgument(gOptarg, &batch);
+                if (retval == 0 && (batch < 1 || batch > IOURING_ENTRIES)){
+                    fprintf(stderr, "Batch must be between 1 and %d.\n", IOURING_ENTRIES);
+                    retval = 1;
+                }
+                break;
+            case 'f':
+                fixedFiles = TRUE;
+                break;
+            case 'r':
+                fixedBuffers = TRUE;
+                break;
+            case 't':
+                retval = setDurationArgument(gOptarg, &tickNs);
+                break;
+            default:
+                retval = 1;
+                break;
+        }
+        if (!iouring && (option == 'b' || option == 'f' || option == 'r')){
+            fprintf(stderr, "-%c only applies to the iouring model.\n", option);
+            retval = 1;
+        }
+    }
+    if (retval || gOptind < gTokenCount - 1){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_MODEL].usage);
+        return;
+    }
+
+    /*  Nothing changes, the tick included, unless the model can be used.  */
+    if (iouring)
+        model = IOURING_MODEL;
+    else if (gTokens[1] == NULL)
+        model = BLOCKING_MODEL;
+    else if (strcasecmp(gTokens[1], "blocking") == 0)
+        model = BLOCKING_MODEL;
+    else if (strcasecmp(gTokens[1], "nonblocking") == 0)
+        model = NONBLOCKING_MODEL;
+    else if (strcasecmp(gTokens[1], "signal") == 0){
+        if (gWorker >= 0){
+            fprintf(stderr, "Workers can't use the signal model, as SIGIO goes to the whole process.\n");
+            return;
+        }
+        model = SIGNAL_MODEL;
+    }
+    else if (strcasecmp(gTokens[1], "rtsignal") == 0)
+        model = RTSIGNAL_MODEL;
+    else if (strcasecmp(gTokens[1], "select") == 0)
+        model = SELECT_MODEL;
+    else if (strcasecmp(gTokens[1], "epoll") == 0)
+        model = EPOLL_MODEL;
+    else if (strcasecmp(gTokens[1], "epollet") == 0)
+        model = EPOLLET_MODEL;
+    else {
+        fprintf(stderr, "Unrecognized model %s\n", gTokens[1]);
+        return;
+    }
+    if (iouring){
+        
+        /*  Create the ring the first time through and register what was asked for.  */
+        gRing.batch = batch;
+        gRing.fixedFiles = fixedFiles;
+        gRing.fixedBuffers = fixedBuffers;
+        if (gRing.fd == UNUSED_FD && uringSetup() < 0)
+            return;
+        if (uringRegister() < 0)
+            return;
+    }
+    gModel = model;
+    gTickNs = tickNs;
+    
+    /*  The model applies to the gCurrent socket and any created from now on.  */
+    if (gModel != RTSIGNAL_MODEL)
+        rtsignalArm(FALSE);
+    gSockets[gCurrent].model = gModel;
+    syncBlockingMode();
+}
+
+
+/*
+ *  Implement use command.
+ *
+ *  use number
+ *
+ */
+static void doUse()
+{
+    int result, newgCurrent;
+    
+    /*  Process command line argument       */
+    if (gTokenCount !=2){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_USE].usage);
+        return;
+    }
+    
+    result = setIntegerArgument(gTokens[1], &newgCurrent);
+    if (result != 0){
+        fprintf(stderr, "Invalid socket number.\n");
+        return;
+    }
+    
+    if (newgCurrent < 0 || newgCurrent >= gSocketSlots || gSockets[newgCurrent].fd == UNUSED_FD){
+        fprintf(stderr, "Socket number %d not open.\n", newgCurrent);
+        return;
+    }
+    
+    gCurrent = newgCurrent;
+}
+
+
+/*
+ *  Implement socket command.
+ *
+ *  socket [-d domain] [-t type] [-p protocol]
+ *
+ *  domain:    number | inet | *inet6
+ *  type:      number | *stream | datagram | raw
+ *  protocol:  number
+ */
+
+static void doSocket()
+{
+    int fd, newgCurrent, retval = 0;
+    int domain, type, protocol;
+    char option;
+    static const struct namedValue domains[] = {{"inet", PF_INET}, {"inet6", PF_INET6}, {NULL}};
+    static const struct namedValue types[] = {
+        {"stream", SOCK_STREAM}, {"datagram", SOCK_DGRAM}, {"raw", SOCK_RAW}, {NULL}
+    };
+    static const struct namedValue protocols[] = {{NULL}};
+    static struct nameIndex domainIndex, typeIndex, protocolIndex;
+    
+    /*  Set defaults.  */
+    domain = PF_INET6;
+    type = SOCK_STREAM;
+    protocol = 0;
+    
+    /*  Process command line arguments      */
+    gOptind = 0;
+    while (retval == 0 && (option = getOption(gTokenCount, gTokens, "d:t:p:")) != -1){
+        switch (option){        
+            case 'd':
+                retval = getNamedValue(gOptarg, domains, &domainIndex, &domain);
+                break;          
+            case 't':
+                retval = getNamedValue(gOptarg, types, &typeIndex, &type);
+                break;          
+            case 'p':
+                retval = getNamedValue(gOptarg, protocols, &protocolIndex, &protocol);
+                break;          
+            default:
+                fprintf(stderr, "Unknown option %c.\n", option);
+                return;
+        }
+    }
+    if (gOptind < gTokenCount){
+        fprintf(stderr, "Unexpected argument(s) at end of command.\n");
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_SOCKET].usage);
+        return;
+    }
+    if (retval){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_SOCKET].usage);
+        return;
+    }
+    
+    /*  Find a free socket slot.  */
+    newgCurrent = findFreeSocketSlot();
+    if (newgCurrent < 0)
+        return;
+    
+    /*  Call the socket() API.  The new socket only becomes current once it exists.  */
+    fd = socket(domain, type | modelSocketFlags(gModel), protocol);
+    if (fd < 0){
+        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", fd, errno, strerror(errno));
+        return;
+    }   
+    claimSocketSlot(newgCurrent, fd, domain, type, protocol, gModel, modelSocketFlags(gModel) != 0);
+    gCurrent = newgCurrent;
+}
+
+
+/*
+ *  Implement bind command.
+ *
+ *  bind portnumber [ hostaddress ]
+ *
+ */
+static void doBind()
+{
+    int result;
+    int port;
+    struct addrinfo *addrInfo;
+    struct addrinfo hints = {0, 0, 0, 0, 0, NULL, NULL, NULL};
+    struct sockaddr_in6 *addr, wildcard = {AF_INET6, 0, 0, IN6ADDR_ANY_INIT, 0};
+    
+    /*  Process command line arguments      */
+    if (gTokenCount < 2 || gTokenCount > 3){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_BIND].usage);
+        return;
+    }
+    
+    result = setIntegerArgument(gTokens[1], &port);
+    if (result != 0){
+        fprintf(stderr, "Invalid port number.\n");
+        return;
+    }
+    
+    if (gTokenCount == 3){
+        /*  Translate/lookup host address/name.  */
+        hints.ai_family = gSockets[gCurrent].domain;
+        hints.ai_socktype = gSockets[gCurrent].type;
+        hints.ai_protocol = gSockets[gCurrent].protocol;
+        result = getaddrinfo(gTokens[2], NULL, &hints, &addrInfo);
+        if (result){
+            fprintf(stderr, "Error - %s is not a valid address:  %s.\n", gTokens[2], gai_strerror(result));
+            return;
+        }
+        addr = (struct sockaddr_in6 *)addrInfo->ai_addr;
+    }
+    else {
+        addr = &wildcard;
+    }
+    
+    /*  Plug the port number into the address.  */
+#ifdef SOLARIS
+    assert(offsetof(struct sockaddr_in, sin_port) == offsetof(struct sockaddr_in6, sin6_port));
+#endif
+    addr->sin6_port = htons(port);
+    
+    /*  Call the bind() API.  */
+    result = bind(gSockets[gCurrent].fd, (struct sockaddr *)addr, sizeof(*addr));
+    if (result < 0){
+        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+        return;
+    }   
+}
+
+
+/*
+ *  Implement connect command.
+ *
+ *  connect portnumber [ hostaddress ]
+ *
+ */
+static void doConnect()
+{
+    int result, done;
+    int port;
+    struct addrinfo *addrInfo;
+    struct addrinfo hints = {0, 0, 0, 0, 0, NULL, NULL, NULL};
+
+    /*  Process command line arguments      */
+    if (gTokenCount < 2 || gTokenCount > 3){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_CONNECT].usage);
+        return;
+    }
+    
+    result = setIntegerArgument(gTokens[1], &port);
+    if (result != 0){
+        fprintf(stderr, "Invalid port number.\n");
+        return;
+    }
+    
+    /*  Translate/lookup host address/name.  */
+    hints.ai_family = gSockets[gCurrent].domain;
+    hints.ai_socktype = gSockets[gCurrent].type;
+    hints.ai_protocol = gSockets[gCurrent].protocol;
+    result = getaddrinfo(gTokens[2], NULL, &hints, &addrInfo);
+    if (result){
+        fprintf(stderr, "Error - %s is not a valid address:  %s.\n", gTokens[2], gai_strerror(result));
+        return;
+    }
+    
+    /*  Plug the port number into the address.  */
+#ifdef SOLARIS
+    assert(offsetof(struct sockaddr_in, sin_port) == offsetof(struct sockaddr_in6, sin6_port));
+#endif
+    ((struct sockaddr_in6 *)(addrInfo->ai_addr))->sin6_port = htons(port);
+    
+    /*  Call the connect() API.  */
+    do {
+        preAPISetup(READ_READY);    
+        if (gInterrupted)
+            return;
+        result = apiConnect(gSockets[gCurrent].fd, addrInfo->ai_addr, sizeof(struct sockaddr_in6));
+        done = postAPISetup(result);
+    } while (!done);
+
+    
+    /*  Call the connect() API.  */
+    if (result < 0){
+        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+        return;
+    }   
+}
+
+
+/*
+ *  Implement listen command.
+ *
+ *  listen [backlogCount]
+ *
+ *  Backlog defaults to 1 if not specified.
+ *
+ */
+static void doListen()
+{
+    int result;
+    int backlog = 1;
+    
+    /*  Process command line arguments      */
+    if (gTokenCount > 2){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_LISTEN].usage);
+        return;
+    }
+    
+    if (gTokenCount == 2){
+        result = setIntegerArgument(gTokens[1], &backlog);
+        if (result != 0){
+            fprintf(stderr, "Invalid backlog count.\n");
+                return;
+        }
+    }
+
+    /*  Call the listen() API.  */
+    result = listen(gSockets[gCurrent].fd, backlog);
+    if (result < 0){
+        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+        return;
+    }   
+}
+
+
+/*
+ *  Implement accept command.
+ *
+ *  accept [-d]
+ *
+ *  -d drains the backlog:  after the model's wait for the listener to become readable, 
+ *  it keeps accepting until there is nothing left.  It uses accept4() to create the new
+ *  sockets close-on-exec, and nonblocking in the nonblocking model, instead of the two
+ *  fcntl() calls apiece a server would otherwise need to set each flag.
+ */
+static __thread struct histogram *gAcceptBatches;   /*  Connections accepted per accept -d wakeup  */
+static __thread long gFcntlSaved;                   /*  fcntl() calls accept4() saved them  */
+
+static void doAccept()
+{
+    int result, newgCurrent, listener;
+    struct sockaddr_in6 saddr;
+    socklen_t len = sizeof(saddr);
+    int done, drain = FALSE, flags = 0, accepted, wasNonblocking, last;
+    char option;
+    
+    /*  Process command line arguments      */
+    gOptind = 0;
+    while ((option = getOption(gTokenCount, gTokens, "d")) != -1){
+        if (option != 'd'){
+            fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_ACCEPT].usage);
+            return;
+        }
+        drain = TRUE;
+    }
+    if (gOptind < gTokenCount){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_ACCEPT].usage);
+        return;
+    }
+    flags = modelSocketFlags(gSockets[gCurrent].model);
+    if (drain)
+        flags |= SOCK_CLOEXEC;
+    
+    /*  Find a free socket slot.  */
+    newgCurrent = findFreeSocketSlot();
+    if (newgCurrent < 0)
+        return;
+        
+    /*  Call the API.  */
+    do {
+        preAPISetup(READ_READY);    
+        if (gInterrupted)
+            return;
+        result = apiAccept(gSockets[gCurrent].fd, (struct sockaddr *)&saddr, &len, flags);    
+        done = postAPISetup(result);
+    } while (!done);
+    if (result < 0){
+        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+        return;
+    }   
+
+    /*  Update our state.  The new socket inherits the listener's attributes.  */
+    listener = gCurrent;
+    claimSocketSlot(newgCurrent, result, gSockets[gCurrent].domain, gSockets[gCurrent].type, 
+                        gSockets[gCurrent].protocol, gSockets[gCurrent].model, (flags & SOCK_NONBLOCK) != 0);
+    gCurrent = newgCurrent;
+    if (!drain)
+        return;
+    
+    /*  Drain the rest of the backlog with the listener nonblocking.  */
+    accepted = 1;
+    last = newgCurrent;
+    gCurrent = listener;
+    wasNonblocking = gSockets[listener].nonblocking;
+    if (!wasNonblocking){
+        setFctlFlag(O_NONBLOCK);
+        gSockets[listener].nonblocking = TRUE;
+    }
+    gBulk = TRUE;
+    while (!gInterrupted && (newgCurrent = findFreeSocketSlot()) >= 0){
+        len = sizeof(saddr);
+        doBlockingSetup();
+        result = accept4(gSockets[listener].fd, (struct sockaddr *)&saddr, &len, flags);
+        if (result < 0)
+            break;
+        verifyBlocking(FALSE);
+        claimSocketSlot(newgCurrent, result, gSockets[listener].domain, gSockets[listener].type, 
+                            gSockets[listener].protocol, gSockets[listener].model, (flags & SOCK_NONBLOCK) != 0);
+        last = newgCurrent;
+        accepted++;
+    }
+    gBulk = FALSE;
+    if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+    syncBlockingMode();
+    gCurrent = last;
+    
+    /*  Account for the wakeup.  */
+    if (gAcceptBatches == NULL && (gAcceptBatches = malloc(sizeof(*gAcceptBatches))) != NULL)
+        histReset(gAcceptBatches);
+    if (gAcceptBatches != NULL)
+        histRecord(gAcceptBatches, accepted);
+    /*  Each flag set by accept4() saves an F_GETxx and F_SETxx; a blocking listener costs a toggle.  */
+    gFcntlSaved += accepted * ((flags & SOCK_NONBLOCK) ? 4 : 2) - (wasNonblocking ? 0 : 4);
+    printf("Accepted %d connection%s in one wakeup.\n", accepted, accepted == 1 ? "" : "s");
+}
+
+
+/*
+ *  Connection load.  Client threads that connect to an address and close again as fast as
+ *  they can until a deadline, timing each connect().
+ */
+struct connectClient {
+    pthread_t thread;
+    int domain;
+    const struct sockaddr *addr;             /*  Where to connect  */
+    socklen_t addrLength;
+    const long long *endNs;                  /*  When to stop  */
+    const volatile int *stop;                /*  Set to stop early  */
+    int reset;                               /*  Close with an RST (SO_LINGER of 0)?  */
+    long long connects, errors;
+    long long addrNotAvail;                  /*  Errors that were EADDRNOTAVAIL:  out of ports  */
+    struct histogram latency;                /*  connect() latency  */
+};
+
+
+/*  Body of a client thread.  */
+static void *connectClientThread(void *arg)
+{
+    struct connectClient *client = arg;
+    struct linger linger = {1, 0};
+    long long start;
+    int fd, result;
+    
+    while (!*client->stop && !gInterrupted && nowNs() < *client->endNs){
+        fd = socket(client->domain, SOCK_STREAM, 0);
+        if (fd < 0){
+            client->errors++;
+            continue;
+        }
+        start = nowNs();
+        result = connect(fd, client->addr, client->addrLength);
+        if (result == 0){
+            histRecord(&client->latency, nowNs() - start);
+            client->connects++;
+        } else {
+            client->errors++;
+            client->addrNotAvail += errno == EADDRNOTAVAIL;
+        }
+        if (client->reset)
+            (void) setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+        (void) close(fd);
+    }
+    return NULL;
+}
+
+
+/*
+ *  Accept connections on a nonblocking listener and close them again until the deadline,
+ *  polling so the deadline is noticed.  Returns the number accepted.
+ */
+static long long acceptAndClose(int listener, const long long *endNs, const volatile int *stop,
+                                    struct histogram *latency, long long *errors)
+{
+    struct pollfd pfd;
+    long long start, now, accepts = 0;
+    int fd;
+    
+    pfd.fd = listener;
+    pfd.events = POLLIN;
+    while (!*stop && !gInterrupted && (now = nowNs()) < *endNs){
+        if (poll(&pfd, 1, MIN(100, (*endNs - now) / 1000000 + 1)) <= 0)
+            continue;
+        start = nowNs();
+        fd = accept(listener, NULL, NULL);
+        if (fd < 0){
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                (*errors)++;
+            continue;
+        }
+        histRecord(latency, nowNs() - start);
+        accepts++;
+        (void) close(fd);
+    }
+    return accepts;
+}
+
+
+/*  Start count client threads.  Returns how many were started.  */
+static int startConnectClients(struct connectClient clients[], int count)
+{
+    int i, result;
+    
+    for (i = 0; i < count; i++){
+        result = pthread_create(&clients[i].thread, NULL, connectClientThread, &clients[i]);
+        if (result != 0){
+            fprintf(stderr, "Unable to start client %d - %s.\n", i, strerror(result));
+            break;
+        }
+    }
+    return i;
+}
+
+
+/*  A shards thread, with its own listener on the shared port.  */
+struct shard {
+    pthread_t thread;
+    int number;
+    int cpu;                                 /*  CPU it is pinned to, or -1  */
+    int listening;                           /*  Did it get its listener going?  */
+    long long accepts, errors;
+    struct histogram latency;                /*  accept() latency  */
+    struct shardSet *set;
+};
+
+struct shardSet {
+    char *host;
+    int domain, port, backlog;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int ready;                               /*  Shards that are listening, or have given up  */
+    int go;                                  /*  Set once they all are  */
+    long long endNs;
+    volatile int stop;
+};
+
+static void runCommandLine(const char *format, ...);
+
+
+/*  Body of a shard thread.  */
+static void *shardThread(void *arg)
+{
+    struct shard *shard = arg;
+    struct shardSet *set = shard->set;
+    cpu_set_t cpus;
+    enum command_enum cmd;
+    enum model_enum m;
+    int listening = 0;
+    socklen_t length = sizeof(listening);
+    
+    if (shard->cpu >= 0){
+        CPU_ZERO(&cpus);
+        CPU_SET(shard->cpu, &cpus);
+        (void) pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    
+    /*  Set up the listener in this thread's own socket table.  */
+    gWorker = shard->number;
+    gModel = BLOCKING_MODEL;
+    if (growSocketTable() == 0){
+        runCommandLine("socket -d %s", set->domain == AF_INET ? "inet" : "inet6");
+        if (gSockets[gCurrent].fd != UNUSED_FD){
+            runCommandLine("setsockopt so_reuseport on");
+            runCommandLine("bind %d %s", set->port, set->host);
+            runCommandLine("listen %d", set->backlog);
+            (void) getsockopt(gSockets[gCurrent].fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &length);
+            shard->listening = listening;
+        }
+    }
+    if (shard->listening){
+        setFctlFlag(O_NONBLOCK);
+        gSockets[gCurrent].nonblocking = TRUE;
+    }
+    
+    /*  Wait for the others.  */
+    pthread_mutex_lock(&set->lock);
+    set->ready++;
+    pthread_cond_broadcast(&set->changed);
+    while (!set->go)
+        pthread_cond_wait(&set->changed, &set->lock);
+    pthread_mutex_unlock(&set->lock);
+    
+    if (shard->listening)
+        shard->accepts = acceptAndClose(gSockets[gCurrent].fd, &set->endNs, &set->stop, 
+                                            &shard->latency, &shard->errors);
+    
+    if (gSockets[gCurrent].fd != UNUSED_FD)
+        (void) close(gSockets[gCurrent].fd);
+    
+    /*  The commands it ran kept latencies in this thread's own histograms.  */
+    for (cmd = 0; cmd < NUM_COMMANDS; cmd++)
+        for (m = 0; m < NUM_MODELS; m++)
+            free(gHistograms[cmd][m]);
+    free(gSockets);
+    return NULL;
+}
+
+
+/*
+ *  Implement shards command.
+ *
+ *  shards count port duration [-c clients] [-a hostaddress] [-b backlog]
+ *
+ *  Starts count threads, each pinned to its own CPU, that each set up a listener on the
+ *  same port with SO_REUSEPORT (using the socket, setsockopt, bind and listen commands) and
+ *  accept connections until the duration is up.  -c starts client threads that connect to
+ *  the port as fast as they can.  Reports how many connections each shard accepted.
+ */
+static void doShards()
+{
+    struct shardSet set;
+    struct shard *shards = NULL;
+    struct connectClient *clients = NULL;
+    struct addrinfo hints, *addrInfo = NULL;
+    struct histogram latency;
+    cpu_set_t allowed;
+    long long durationNs, count, clientCount = 0, start, elapsed, total = 0, connects = 0, errors = 0;
+    int i, cpu, retval = 0, started = 0, clientsStarted = 0, failed = 0, result;
+    char option, label[40];
+    
+    /*  Process command line arguments      */
+    memset(&set, 0, sizeof(set));
+    set.host = "127.0.0.1";
+    set.backlog = SOMAXCONN;
+    gOptind = 0;
+    while (retval == 0 && (option = getOption(gTokenCount, gTokens, "c:a:b:")) != -1){
+        switch (option){
+            case 'c':
+                retval = setSizeArgument(gOptarg, &clientCount);
+                break;
+            case 'a':
+                set.host = gOptarg;
+                break;
+            case 'b':
+                retval = setIntegerArgument(gOptarg, &set.backlog);
+                break;
+            default:
+                retval = 1;
+                break;
+        }
+    }
+    if (retval || gOptind != gTokenCount - 3 || setSizeArgument(gTokens[gOptind], &count) != 0 || 
+            setIntegerArgument(gTokens[gOptind + 1], &set.port) != 0 ||
+            setDurationArgument(gTokens[gOptind + 2], &durationNs) != 0 ||
+            count < 1 || count > MAX_WORKERS || clientCount < 0 || clientCount > MAX_WORKERS){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_SHARDS].usage);
+        return;
+    }
+    
+    /*  Work out the address the clients connect to.  */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    result = getaddrinfo(set.host, NULL, &hints, &addrInfo);
+    if (result){
+        fprintf(stderr, "Error - %s is not a valid address:  %s.\n", set.host, gai_strerror(result));
+        return;
+    }
+    set.domain = addrInfo->ai_family;
+    ((struct sockaddr_in *)addrInfo->ai_addr)->sin_port = htons(set.port);
+    
+    shards = calloc(count, sizeof(*shards));
+    clients = calloc(clientCount + 1, sizeof(*clients));
+    if (shards == NULL || clients == NULL){
+        fprintf(stderr, "Unable to allocate shards.\n");
+        goto done;
+    }
+    
+    /*  Start the shards, pinning them to the CPUs we may run on in turn.  */
+    CPU_ZERO(&allowed);
+    (void) sched_getaffinity(0, sizeof(allowed), &allowed);
+    pthread_mutex_init(&set.lock, NULL);
+    pthread_cond_init(&set.changed, NULL);
+    for (i = 0, cpu = 0; i < count; i++){
+        shards[i].number = i;
+        shards[i].set = &set;
+        shards[i].cpu = -1;
+        if (CPU_COUNT(&allowed) > 0){
+            while (!CPU_ISSET(cpu % CPU_SETSIZE, &allowed))
+                cpu++;
+            shards[i].cpu = cpu % CPU_SETSIZE;
+            cpu = (cpu + 1) % CPU_SETSIZE;
+        }
+        result = pthread_create(&shards[i].thread, NULL, shardThread, &shards[i]);
+        if (result != 0){
+            fprintf(stderr, "Unable to start shard %d - %s.\n", i, strerror(result));
+            break;
+        }
+    }
+    started = i;
+    
+    /*  Once they are all listening, start the clock.  A shard that couldn't stops the others.  */
+    pthread_mutex_lock(&set.lock);
+    while (set.ready < started)
+        pthread_cond_wait(&set.changed, &set.lock);
+    for (i = 0; i < started; i++)
+        failed += !shards[i].listening;
+    if (failed || started < count)
+        set.stop = TRUE;
+    start = nowNs();
+    set.endNs = start + durationNs;
+    set.go = TRUE;
+    pthread_cond_broadcast(&set.changed);
+    pthread_mutex_unlock(&set.lock);
+    
+    /*  Run the clients until the time is up.  */
+    for (i = 0; i < clientCount && !set.stop; i++){
+        clients[i].domain = set.domain;
+        clients[i].addr = addrInfo->ai_addr;
+        clients[i].addrLength = addrInfo->ai_addrlen;
+        clients[i].endNs = &set.endNs;
+        clients[i].stop = &set.stop;
+    }
+    if (!set.stop)
+        clientsStarted = startConnectClients(clients, clientCount);
+    for (i = 0; i < clientsStarted; i++)
+        (void) pthread_join(clients[i].thread, NULL);
+    for (i = 0; i < started; i++)
+        (void) pthread_join(shards[i].thread, NULL);
+    elapsed = nowNs() - start;
+    pthread_mutex_destroy(&set.lock);
+    pthread_cond_destroy(&set.changed);
+    if (failed || started < count){
+        fprintf(stderr, "Error - %d of %lld shards couldn't listen on port %d.\n", 
+                    failed + (int)(count - started), count, set.port);
+        goto done;
+    }
+    
+    /*  Report each shard's share of the connections.  */
+    for (i = 0; i < count; i++)
+        total += shards[i].accepts;
+    printf("%6s %4s %10s %12s %7s %8s\n", "shard", "cpu", "accepts", "accepts/s", "share", "errors");
+    for (i = 0; i < count; i++)
+        printf("%6d %4d %10lld %12.0f %6.1f%% %8lld\n", i, shards[i].cpu, shards[i].accepts, 
+                    shards[i].accepts * 1e9 / elapsed, total ? 100.0 * shards[i].accepts / total : 0.0, 
+                    shards[i].errors);
+    printf("%6s %4s %10lld %12.0f\n", "total", "", total, total * 1e9 / elapsed);
+    histPrintHeader("accept latency");
+    for (i = 0; i < count; i++){
+        snprintf(label, sizeof(label), "shard %d", i);
+        histPrintLine(label, &shards[i].latency);
+    }
+    
+    if (clientsStarted > 0){
+        histReset(&latency);
+        for (i = 0; i < clientsStarted; i++){
+            histMerge(&latency, &clients[i].latency);
+            connects += clients[i].connects;
+            errors += clients[i].errors;
+        }
+        printf("%d clients made %lld connections (%.0f/s), %lld failed.\n", clientsStarted, connects, 
+                    connects * 1e9 / elapsed, errors);
+        histPrintLine("connect latency", &latency);
+    }
+    
+done:
+    free(shards);
+    free(clients);
+    if (addrInfo != NULL)
+        freeaddrinfo(addrInfo);
+}
+
+
+/*  The connstorm accept thread and what it counted.  */
+struct acceptor {
+    int fd;
+    const long long *endNs;
+    const volatile int *stop;
+    long long accepts, errors;
+    struct histogram latency;
+};
+
+
+/*  Body of the connstorm accept thread.  */
+static void *acceptorThread(void *arg)
+{
+    struct acceptor *acceptor = arg;
+    
+    acceptor->accepts = acceptAndClose(acceptor->fd, acceptor->endNs, acceptor->stop, 
+                                        &acceptor->latency, &acceptor->errors);
+    return NULL;
+}
+
+
+/*  Read count integers from a /proc/sys file.  Returns 0, or -1 if they couldn't be read.  */
+static int readSysctl(const char *path, int values[], int count)
+{
+    FILE *file;
+    int i;
+    
+    file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+    for (i = 0; i < count && fscanf(file, "%d", &values[i]) == 1; i++)
+        ;
+    fclose(file);
+    return i == count ? 0 : -1;
+}
+
+
+/*  
+ *  Count the TCP sockets in TIME_WAIT:  in all, those of clients that connected to the 
+ *  given port, and those of the server side, whose local port it is.
+ */
+static long countTimeWait(unsigned port, long *clientSide, long *serverSide)
+{
+    static char *files[] = {"/proc/net/tcp", "/proc/net/tcp6"};
+    char line[256], local[64], remote[64];
+    unsigned localPort, remotePort, state;
+    long count = 0;
+    FILE *file;
+    size_t i;
+    
+    *clientSide = *serverSide = 0;
+    for (i = 0; i < sizeof(files) / sizeof(files[0]); i++){
+        file = fopen(files[i], "r");
+        if (file == NULL)
+            continue;
+        while (fgets(line, sizeof(line), file) != NULL){
+            if (sscanf(line, " %*d: %63[0-9A-Fa-f]:%x %63[0-9A-Fa-f]:%x %x", local, &localPort, 
+                        remote, &remotePort, &state) != 5)
+                continue;
+            if (state == 0x06){                          /*  TCP_TIME_WAIT  */
+                count++;
+                *serverSide += localPort == port;
+                *clientSide += remotePort == port;
+            }
+        }
+        fclose(file);
+    }
+    return count;
+}
+
+
+/*
+ *  Implement connstorm command.
+ *
+ *  connstorm clients duration [-a hostaddress] [-r]
+ *
+ *  Sets up its own listener on an ephemeral port and runs client threads that connect
+ *  and close as fast as they can for the duration, while another thread accepts and 
+ *  closes.  -r closes the clients with an RST, so they leave nothing in TIME_WAIT.  
+ *  Reports the connection rate, connect latency, running out of ephemeral ports and 
+ *  how many sockets were left in TIME_WAIT.
+ */
+static void doConnstorm()
+{
+    struct connectClient *clients;
+    struct acceptor acceptor;
+    struct histogram latency;
+    struct sockaddr_storage addr;
+    socklen_t addrLength = sizeof(addr);
+    struct addrinfo hints, *addrInfo;
+    long long count, durationNs, start, endNs, elapsed, connects = 0, errors = 0, addrNotAvail = 0;
+    long timeWaitBefore, timeWaitAfter, clientSide, serverSide;
+    volatile int stop = FALSE;
+    int i, result, retval = 0, reset = FALSE, started, port, ports[2] = {0, 0}, maxTimeWait = 0;
+    char option, *host = "127.0.0.1";
+    pthread_t acceptThread;
+    
+    /*  Process command line arguments      */
+    gOptind = 0;
+    while (retval == 0 && (option = getOption(gTokenCount, gTokens, "a:r")) != -1){
+        switch (option){
+            case 'a':
+                host = gOptarg;
+                break;
+            case 'r':
+                reset = TRUE;
+                break;
+            default:
+                retval = 1;
+                break;
+        }
+    }
+    if (retval || gOptind != gTokenCount - 2 || setSizeArgument(gTokens[gOptind], &count) != 0 || 
+            setDurationArgument(gTokens[gOptind + 1], &durationNs) != 0 || count < 1 || count > MAX_WORKERS){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_CONNSTORM].usage);
+        return;
+    }
+    
+    /*  Listen on an ephemeral port of the address.  */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    result = getaddrinfo(host, NULL, &hints, &addrInfo);
+    if (result){
+        fprintf(stderr, "Error - %s is not a valid address:  %s.\n", host, gai_strerror(result));
+        return;
+    }
+    memset(&acceptor, 0, sizeof(acceptor));
+    acceptor.fd = socket(addrInfo->ai_family, SOCK_STREAM, 0);
+    if (acceptor.fd < 0 || bind(acceptor.fd, addrInfo->ai_addr, addrInfo->ai_addrlen) < 0 ||
+            listen(acceptor.fd, SOMAXCONN) < 0 || 
+            getsockname(acceptor.fd, (struct sockaddr *)&addr, &addrLength) < 0 ||
+            fcntl(acceptor.fd, F_SETFL, O_NONBLOCK) < 0){
+        fprintf(stderr, "Unable to listen on %s - %s.\n", host, strerror(errno));
+        if (acceptor.fd >= 0)
+            close(acceptor.fd);
+        freeaddrinfo(addrInfo);
+        return;
+    }
+    freeaddrinfo(addrInfo);
+    port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+    
+    clients = calloc(count, sizeof(*clients));
+    if (clients == NULL){
+        fprintf(stderr, "Unable to allocate %lld clients.\n", count);
+        close(acceptor.fd);
+        return;
+    }
+    
+    /*  Run the storm.  */
+    timeWaitBefore = countTimeWait(port, &clientSide, &serverSide);
+    start = nowNs();
+    endNs = start + durationNs;
+    acceptor.endNs = &endNs;
+    acceptor.stop = &stop;
+    for (i = 0; i < count; i++){
+        clients[i].domain = addr.ss_family;
+        clients[i].addr = (struct sockaddr *)&addr;
+        clients[i].addrLength = addrLength;
+        clients[i].endNs = &endNs;
+        clients[i].stop = &stop;
+        clients[i].reset = reset;
+    }
+    result = pthread_create(&acceptThread, NULL, acceptorThread, &acceptor);
+    if (result != 0){
+        fprintf(stderr, "Unable to start the accept thread - %s.\n", strerror(result));
+        free(clients);
+        close(acceptor.fd);
+        return;
+    }
+    started = startConnectClients(clients, count);
+    for (i = 0; i < started; i++)
+        (void) pthread_join(clients[i].thread, NULL);
+    (void) pthread_join(acceptThread, NULL);
+    elapsed = nowNs() - start;
+    close(acceptor.fd);
+    timeWaitAfter = countTimeWait(port, &clientSide, &serverSide);
+    
+    /*  Report.  */
+    histReset(&latency);
+    for (i = 0; i < started; i++){
+        histMerge(&latency, &clients[i].latency);
+        connects += clients[i].connects;
+        errors += clients[i].errors;
+        addrNotAvail += clients[i].addrNotAvail;
+    }
+    printf("%d clients made %lld connections in %.3f s (%.0f/s); %lld accepted, %lld failed, %lld EADDRNOTAVAIL.\n",
+                started, connects, elapsed / 1e9, connects * 1e9 / elapsed, acceptor.accepts, errors, addrNotAvail);
+    histPrintHeader("latency");
+    histPrintLine("connect", &latency);
+    histPrintLine("accept", &acceptor.latency);
+    (void) readSysctl("/proc/sys/net/ipv4/ip_local_port_range", ports, 2);
+    (void) readSysctl("/proc/sys/net/ipv4/tcp_max_tw_buckets", &maxTimeWait, 1);
+    printf("TIME_WAIT sockets:  %ld before, %ld after (limit %d).  To port %d, %ld client side, %ld server side.\n",
+                timeWaitBefore, timeWaitAfter, maxTimeWait, port, clientSide, serverSide);
+    printf("Ephemeral ports %d-%d.\n", ports[0], ports[1]);
+    free(clients);
+}
+
+
+#define ZEROCOPY_DRAIN_INTERVAL  32              /*  MSG_ZEROCOPY sends between error queue drains  */
+
+struct zerocopyStats {
+    long sends;                                  /*  Sends made with MSG_ZEROCOPY  */
+    long completed;                              /*  Sends whose completion has been reaped  */
+    long copied;                                 /*  Completed sends the kernel fell back to copying  */
+};
+
+
+/*  Enable SO_ZEROCOPY on a socket so that MSG_ZEROCOPY sends are honored.  */
+static int enableZerocopy(int fd)
+{
+    int one = 1;
+    
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0){
+        fprintf(stderr, "Error setting SO_ZEROCOPY - %s.\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ *  Reap MSG_ZEROCOPY completion notifications from the socket error queue.  If wait is
+ *  set, keep waiting until every send has completed or no completion arrives for a second.
+ */
+static void drainZerocopy(int fd, struct zerocopyStats *zc, int wait)
+{
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct sock_extended_err *serr;
+    struct pollfd pfd;
+    char control[128];
+    long count;
+    
+    while (zc->completed < zc->sends){
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0){
+            if (errno != EAGAIN || !wait)
+                return;
+                
+            /*  An error queue with something on it polls as POLLERR.  */
+            pfd.fd = fd;
+            pfd.events = 0;
+            if (poll(&pfd, 1, 1000) <= 0 || gInterrupted)
+                return;
+            continue;
+        }
+        
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+            if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) || 
+                    (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
+                continue;
+            serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+                
+            /*  Each notification covers the range of send sequence numbers [ee_info, ee_data].  */
+            count = serr->ee_data - serr->ee_info + 1;
+            zc->completed += count;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                zc->copied += count;
+        }
+    }
+}
+
+
+/*  Report how the MSG_ZEROCOPY sends were actually carried out.  */
+static void reportZerocopy(struct zerocopyStats *zc)
+{
+    printf("%ld MSG_ZEROCOPY sends:  %ld zero-copied, %ld copied by the kernel, %ld not completed.\n", 
+                zc->sends, zc->completed - zc->copied, zc->copied, zc->sends - zc->completed);
+}
+
+
+/*
+ *  Implement recvmsg command.
+ *
+ *  recvmsg [-f OOB]
+ *
+ */
+static void doRecvmsg()
+{
+    int result;
+    char option;
+    int done, flags = 0;
+    struct msghdr msgInfo;
+    struct iovec iov;
+    char buffer[BUFFER_SIZE];
+    struct sockaddr_in6 saddr;
+    char temp[100];
+    char hexBuffer[MAX_DATA_DISPLAY*3 + 1];
+    int i, bytesToDisplay, retval = 0;
+    static const struct namedValue flagValues[] = {{"oob", MSG_OOB}, {NULL}};
+    static struct nameIndex flagIndex;
+    int atMark;
+        
+    /*  Process command line arguments      */
+    gOptind = 0;
+    while (retval == 0 && (option = getOption(gTokenCount, gTokens, "f:")) != -1){
+        switch (option){        
+            case 'f':
+                retval = getNamedValue(gOptarg, flagValues, &flagIndex, &flags);
+                break;          
+            default:
+                fprintf(stderr, "Unknown option %c.\n", option);
+                return;
+        }
+    }
+    if (gOptind < gTokenCount){
+        fprintf(stderr, "Unexpected argument(s) at end of command.\n");
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_RECVMSG].usage);
+        return;
+    }
+    if (retval){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_RECVMSG].usage);
+        return;
+    }
+
+    /*  Fill in the msghdr.  */
+    iov.iov_base = buffer;
+    iov.iov_len = sizeof(buffer);
+    msgInfo.msg_name = &saddr;
+    msgInfo.msg_namelen = sizeof(saddr);
+    msgInfo.msg_iov = &iov;
+    msgInfo.msg_iovlen = 1;
+    msgInfo.msg_control = NULL;
+    msgInfo.msg_controllen = 0;
+    msgInfo.msg_flags = 0;
+    
+    /*  Call the API.  */
+    do {
+        preAPISetup(READ_READY);    
+        if (gInterrupted)
+            return;
+        result = apiRecvmsg(gSockets[gCurrent].fd, &msgInfo, flags);
+        done = postAPISetup(result);
+    } while (!done);
+    if (result < 0){
+        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+        return;
+    }
+    gSockets[gCurrent].bytesIn += result;
+    
+    if (gVerbose){
+        
+        if (result == 0)
+            printf("End of file returned.\n");
+        else 
+            printf("%d bytes read.\n", result);
+        if (gSockets[gCurrent].type != SOCK_STREAM)
+            fprintf(stdout, "Source address = %s.\n", inet_ntop(gSockets[gCurrent].domain, &saddr.sin6_addr, 
+                (char *)&temp, sizeof(temp)));              
+
+        bytesToDisplay = MIN(result, MAX_DATA_DISPLAY);
+        for (i = 0; i < bytesToDisplay; i++){
+            snprintf(temp, sizeof(temp), "%.8x ", (unsigned)buffer[i]);
+            strncpy(&hexBuffer[i*3], &temp[6], 3);
+        }
+        hexBuffer[i*3] = '\0';
+        printf("First %d bytes received are: %s\n", bytesToDisplay, hexBuffer);
+    }
+    
+    result = ioctl(gSockets[gCurrent].fd, SIOCATMARK, &atMark);
+    if (result < 0){
+        fprintf(stderr, "Error in ioctl(SIOCATMARK) call - %s.\n", strerror(errno));
+        return;
+    }
+    if (atMark)
+        fprintf(stdout, "SIOCATMARK returned true.\n");
+}
+
+
+/*
+ *  Implement sendmsg command.
+ *
+ *  sendmsg [-a hostaddress port] [-f OOB | ZEROCOPY]
+ *
+ *  ??  This is a first cut.  
+ *
+ */
+static void doSendmsg()
+{
+    int i, result, done;
+    char option;
+    struct msghdr msgInfo;
+    struct iovec iov;
+    char buffer[BUFFER_SIZE];
+    struct addrinfo *addrInfo;
+    struct addrinfo hints = {0, 0, 0, 0, 0, NULL, NULL, NULL};
+    struct sockaddr_in6 *faddr = NULL;
+    int port, flags = 0, retval = 0;
+    static const struct namedValue flagValues[] = {{"oob", MSG_OOB}, {"zerocopy", MSG_ZEROCOPY}, {NULL}};
+    static struct nameIndex flagIndex;
+    struct zerocopyStats zc = {0, 0, 0};
+
+    /*  Process command line arguments      */
+    gOptind = 0;
+    while (retval == 0 && (option = getOption(gTokenCount, gTokens, "a:f:")) != -1){
+        switch (option){        
+            case 'a':
+                hints.ai_family = gSockets[gCurrent].domain;
+                hints.ai_socktype = gSockets[gCurrent].type;
+                hints.ai_protocol = gSockets[gCurrent].protocol;
+                retval = getaddrinfo(gOptarg, NULL, &hints, &addrInfo);
+                if (retval)
+                    fprintf(stderr, "Error - %s is not a valid address:  %s.\n", gOptarg, gai_strerror(retval));
+
+                /*  Translate port number.  */
+                retval = setIntegerArgument(gTokens[gOptind], &port);
+                if (retval != 0)
+                    fprintf(stderr, "Invalid port number.\n");
+                ((struct sockaddr_in6 *)(addrInfo->ai_addr))->sin6_port = htons(port);
+
+                faddr = (struct sockaddr_in6 *)(addrInfo->ai_addr);
+                gOptind += 1;
+                break;          
+            case 'f':
+                retval = getNamedValue(gOptarg, flagValues, &flagIndex, &flags);
+                break;          
+            default:
+                fprintf(stderr, "Unknown option %c.\n", option);
+                return;
+        }
+    }
+    if (gOptind < gTokenCount){
+        fprintf(stderr, "Unexpected argument(s) at end of command.\n");
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_SENDMSG].usage);
+        return;
+    }
+    if (retval){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_SENDMSG].usage);
+        return;
+    }
+    
+    /*  Fill in the msghdr.  */
+    iov.iov_base = buffer;
+    iov.iov_len = sizeof(buffer);
+    msgInfo.msg_name = faddr;
+    msgInfo.msg_namelen = (faddr != NULL) ? sizeof(struct sockaddr_in6) : 0;
+    msgInfo.msg_iov = &iov;
+    msgInfo.msg_iovlen = 1;
+    msgInfo.msg_control = NULL;
+    msgInfo.msg_controllen = 0;
+    msgInfo.msg_flags = 0;
+    
+    /*  Fill the buffer.  */
+    for (i = 0; i < BUFFER_SIZE; i++)
+        buffer[i] = '*';
+    
+    if ((flags & MSG_ZEROCOPY) && enableZerocopy(gSockets[gCurrent].fd) < 0)
+        return;
+    
+    /*  Call the API.  */
+    do {
+        preAPISetup(WRITE_READY);   
+        if (gInterrupted)
+            return;
+        result = apiSendmsg(gSockets[gCurrent].fd, &msgInfo, flags);   
+        done = postAPISetup(result);
+    } while (!done);
+    if (result < 0){
+        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+        return;
+    }
+    gSockets[gCurrent].bytesOut += result;
+    
+    /*  The (stack) buffer can't go away until the kernel is done with it.  */
+    if (flags & MSG_ZEROCOPY){
+        zc.sends = 1;
+        drainZerocopy(gSockets[gCurrent].fd, &zc, TRUE);
+        reportZerocopy(&zc);
+    }
+    
+    if (result == 0 && gVerbose)
+        printf("Zero count returned.\n");
+    else if (result > 0 && gVerbose)
+        printf("%d bytes written.\n", result);
+}
+
+
+/*  Parse the options shared by the bulk read and write commands.  */
+static int getTransferOptions(enum command_enum cmd, long long *bytes, long long *chunk, int *zerocopy)
+{
+    int retval = 0;
+    char option;
+    
+    *bytes = 0;
+    *chunk = 0;
+    if (zerocopy != NULL)
+        *zerocopy = FALSE;
+    gOptind = 0;
+    while (retval == 0 && (option = getOption(gTokenCount, gTokens, zerocopy ? "n:s:z" : "n:s:")) != -1){
+        switch (option){        
+            case 'z':
+                *zerocopy = TRUE;
+                break;          
+            case 'n':
+                retval = setSizeArgument(gOptarg, bytes);
+                break;          
+            case 's':
+                retval = setSizeArgument(gOptarg, chunk);
+                break;          
+            default:
+                fprintf(stderr, "Unknown option %c.\n", option);
+                return -1;
+        }
+    }
+    if (gOptind < gTokenCount){
+        fprintf(stderr, "Unexpected argument(s) at end of command.\n");
+        retval = -1;
+    }
+    if (retval == 0 && (*bytes < 0 || *chunk < 0 || *chunk > INT_MAX)){
+        fprintf(stderr, "Invalid byte count.\n");
+        retval = -1;
+    }
+    if (retval){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[cmd].usage);
+        return -1;
+    }
+    
+    /*  A single transfer defaults to the classic buffer size, a bulk transfer to the whole I/O buffer.  */
+    if (*chunk == 0)
+        *chunk = (*bytes == 0) ? BUFFER_SIZE : IOBUFFER_SIZE;
+    return 0;
+}
+
+
+/*  Get a buffer for chunk bytes, preferring the (registerable) I/O buffer.  */
+static char *getTransferBuffer(long long chunk)
+{
+    char *buffer;
+    
+    if (chunk <= IOBUFFER_SIZE)
+        return gIOBuffer;
+    buffer = malloc(chunk);
+    if (buffer == NULL)
+        fprintf(stderr, "Unable to allocate %lld byte buffer.\n", chunk);
+    return buffer;
+}
+
+
+/*
+ *  TCP_INFO sampling.  While tcpinfo -i is set, bulk writes and sendfile start a thread
+ *  that reads the socket's tcp_info every interval into a ring of the latest samples, 
+ *  which tcpinfo -x exports, so throughput can be lined up against congestion state.
+ */
+#define TCPINFO_SAMPLES  8192                    /*  Samples kept; older ones are overwritten  */
+
+struct tcpSample {
+    long long ns;                                /*  Since the transfer started  */
+    unsigned rtt, rttvar;                        /*  us  */
+    unsigned cwnd, retransmits;                  /*  Segments  */
+    unsigned long long pacingRate, deliveryRate; /*  Bytes/s  */
+    unsigned long long busy, rwndLimited, sndbufLimited;
+                                                 /*  us  */
+    unsigned long long bytesAcked;
+};
+
+struct tcpSampler {
+    int fd;
+    long long intervalNs;
+    long long startNs;
+    struct tcpSample *samples;                   /*  The starting thread's ring  */
+    long count;
+    int stop;
+    pthread_t thread;
+};
+
+static __thread long long gTcpInfoIntervalNs;    /*  0 if bulk transfers aren't sampled  */
+static __thread struct tcpSample *gTcpSamples;   /*  Ring of the last TCPINFO_SAMPLES  */
+static __thread long gTcpSampleCount;            /*  Samples taken by the last transfer  */
+
+
+/*  Read fd's tcp_info into a sample.  */
+static int readTcpSample(int fd, long long startNs, struct tcpSample *sample)
+{
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &length) < 0)
+        return -1;
+    sample->ns = nowNs() - startNs;
+    sample->rtt = info.tcpi_rtt;
+    sample->rttvar = info.tcpi_rttvar;
+    sample->cwnd = info.tcpi_snd_cwnd;
+    sample->retransmits = info.tcpi_total_retrans;
+    sample->pacingRate = info.tcpi_pacing_rate;
+    sample->deliveryRate = info.tcpi_delivery_rate;
+    sample->busy = info.tcpi_busy_time;
+    sample->rwndLimited = info.tcpi_rwnd_limited;
+    sample->sndbufLimited = info.tcpi_sndbuf_limited;
+    sample->bytesAcked = info.tcpi_bytes_acked;
+    return 0;
+}
+
+
+/*  Sample every interval until told to stop, and once more on the way out.  */
+static void *tcpSamplerThread(void *arg)
+{
+    struct tcpSampler *sampler = arg;
+    struct timespec pause;
+    long long next = sampler->startNs, wait;
+    int stop;
+    
+    do {
+        stop = __atomic_load_n(&sampler->stop, __ATOMIC_ACQUIRE);
+        if (readTcpSample(sampler->fd, sampler->startNs, &sampler->samples[sampler->count % TCPINFO_SAMPLES]) < 0)
+            break;
+        sampler->count++;
+        next += sampler->intervalNs;
+        for (wait = next - nowNs(); !stop && wait > 0; wait = next - nowNs()){
+            if (__atomic_load_n(&sampler->stop, __ATOMIC_ACQUIRE))
+                break;
+            pause.tv_sec = 0;
+            pause.tv_nsec = MIN(wait, 10000000);
+            nanosleep(&pause, NULL);
+        }
+    } while (!stop);
+    return NULL;
+}
+
+
+/*  Start sampling the gCurrent socket, if tcpinfo -i asked for it.  Returns FALSE if not.  */
+static int startTcpSampler(struct tcpSampler *sampler)
+{
+    int result;
+    
+    if (gTcpInfoIntervalNs == 0 || gSockets[gCurrent].type != SOCK_STREAM)
+        return FALSE;
+    if (gTcpSamples == NULL && (gTcpSamples = malloc(TCPINFO_SAMPLES * sizeof(*gTcpSamples))) == NULL){
+        fprintf(stderr, "Unable to allocate tcp_info samples.\n");
+        return FALSE;
+    }
+    sampler->fd = gSockets[gCurrent].fd;
+    sampler->intervalNs = gTcpInfoIntervalNs;
+    sampler->startNs = nowNs();
+    sampler->samples = gTcpSamples;
+    sampler->count = 0;
+    sampler->stop = FALSE;
+    result = pthread_create(&sampler->thread, NULL, tcpSamplerThread, sampler);
+    if (result != 0){
+        fprintf(stderr, "Unable to start tcp_info sampler - %s.\n", strerror(result));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+/*  Stop sampling, and say how much there is to export.  */
+static void stopTcpSampler(struct tcpSampler *sampler)
+{
+    __atomic_store_n(&sampler->stop, TRUE, __ATOMIC_RELEASE);
+    pthread_join(sampler->thread, NULL);
+    gTcpSampleCount = sampler->count;
+    printf("%ld tcp_info samples taken, %ld kept (tcpinfo -x to export).\n", sampler->count, 
+                MIN(sampler->count, TCPINFO_SAMPLES));
+}
+
+
+/*  Report the results of a bulk transfer.  */
+static void reportThroughput(const char *what, long long bytes, long calls, long long startNs, 
+                                struct rusage *startUsage)
+{
+    struct rusage usage;
+    double seconds, userSeconds, sysSeconds;
+    
+    seconds = (nowNs() - startNs) / 1e9;
+    getrusage(RUSAGE_SELF, &usage);
+    userSeconds = (usage.ru_utime.tv_sec - startUsage->ru_utime.tv_sec) + 
+                    (usage.ru_utime.tv_usec - startUsage->ru_utime.tv_usec) / 1e6;
+    sysSeconds = (usage.ru_stime.tv_sec - startUsage->ru_stime.tv_sec) + 
+                    (usage.ru_stime.tv_usec - startUsage->ru_stime.tv_usec) / 1e6;
+    if (seconds <= 0)
+        seconds = 1e-9;
+    
+    printf("%lld bytes %s in %.3f s:  %.2f MB/s, %.0f calls/s, %.0f bytes/call.\n", bytes, what, seconds, 
+                bytes / seconds / 1e6, calls / seconds, calls ? (double)bytes / calls : 0.0);
+    printf("CPU time %.3f s user, %.3f s system (%.1f%% of elapsed).\n", userSeconds, sysSeconds, 
+                100.0 * (userSeconds + sysSeconds) / seconds);
+}
+
+
+/*
+ *  Implement read command.
+ *
+ *  read [-n bytes] [-s chunk]
+ *
+ *  Without -n, a single read of chunk (default 100) bytes is done and what was read is
+ *  displayed.  With -n, reads of chunk (default 64k) bytes are repeated until the given
+ *  number of bytes has been received or end of file, and the throughput is reported.
+ *
+ */
+static void doRead()
+{
+    int result = 0;
+    int done;
+    char *buffer;
+    char temp[100];
+    char hexBuffer[MAX_DATA_DISPLAY*3 + 1];
+    int i, bytesToDisplay;
+    long long bytes, chunk, total = 0, startNs;
+    long calls = 0;
+    struct rusage startUsage;
+    
+    /*  Process command line arguments      */
+    if (getTransferOptions(CMD_READ, &bytes, &chunk, NULL) != 0)
+        return;
+    buffer = getTransferBuffer(chunk);
+    if (buffer == NULL)
+        return;
+    
+    /*  Call the API, repeatedly for a bulk transfer.  */
+    gBulk = bytes != 0;
+    getrusage(RUSAGE_SELF, &startUsage);
+    startNs = nowNs();
+    do {
+        do {
+            preAPISetup(READ_READY);    
+            if (gInterrupted)
+                break;
+            result = apiRead(gSockets[gCurrent].fd, buffer, gBulk ? MIN(chunk, bytes - total) : chunk);  
+            done = postAPISetup(result);
+        } while (!done);
+        if (gInterrupted)
+            break;
+        calls++;
+        if (result > 0){
+            total += result;
+            gSockets[gCurrent].bytesIn += result;
+        }
+    } while (gBulk && result > 0 && total < bytes && !gInterrupted);
+    gBulk = FALSE;
+    
+    if (bytes != 0){
+        if (gInterrupted)
+            ;
+        else if (result < 0)
+            fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+        else if (result == 0)
+            printf("End of file returned.\n");
+        reportThroughput("read", total, calls, startNs, &startUsage);
+    } else if (gInterrupted){
+        ;
+    } else if (result < 0){
+        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+    } else if (gVerbose){
+        if(result == 0)
+            printf("End of file returned.\n");
+        else if (result > 0)
+            printf("%d bytes read.\n", result);
+        
+        bytesToDisplay = MIN(result, MAX_DATA_DISPLAY);
+        for (i = 0; i < bytesToDisplay; i++){
+            snprintf(temp, sizeof(temp), "%.8x ", (unsigned)buffer[i]);
+            strncpy(&hexBuffer[i*3], &temp[6], 3);
+        }
+        hexBuffer[i*3] = '\0';
+        printf("First %d bytes received are: %s\n", bytesToDisplay, hexBuffer);
+    }
+    
+    if (buffer != gIOBuffer)
+        free(buffer);
+}
+
+
+/*
+ *  Implement write command.
+ *
+ *  write [-n bytes] [-s chunk] [-z]
+ *
+ *  Without -n, a single write of chunk (default 100) asterisks is done.  With -n, writes 
+ *  of chunk (default 64k) bytes are repeated until the given number of bytes has been 
+ *  sent, and the throughput is reported.  With -z, the data is sent with send(MSG_ZEROCOPY)
+ *  and the completions are reaped from the socket error queue.
+ *
+ */
+static void doWrite()
+{
+    int result = 0, done, zerocopy, sampling;
+    struct zerocopyStats zc = {0, 0, 0};
+    struct tcpSampler sampler;
+    char *buffer;
+    long long bytes, chunk, total = 0, startNs;
+    long calls = 0;
+    struct rusage startUsage;
+    
+    /*  Process command line arguments      */
+    if (getTransferOptions(CMD_WRITE, &bytes, &chunk, &zerocopy) != 0)
+        return;
+    buffer = getTransferBuffer(chunk);
+    if (buffer == NULL)
+        return;
+    
+    /*  Fill the buffer.  */
+    memset(buffer, '*', chunk);
+    
+    if (zerocopy && enableZerocopy(gSockets[gCurrent].fd) < 0){
+        if (buffer != gIOBuffer)
+            free(buffer);
+        return;
+    }
+    
+    /*  Call the API, repeatedly for a bulk transfer.  */
+    gBulk = bytes != 0;
+    sampling = gBulk && startTcpSampler(&sampler);
+    getrusage(RUSAGE_SELF, &startUsage);
+    startNs = nowNs();
+    do {
+        do {
+            preAPISetup(WRITE_READY);   
+            if (gInterrupted)
+                break;
+            if (zerocopy)
+                result = apiSend(gSockets[gCurrent].fd, buffer, gBulk ? MIN(chunk, bytes - total) : chunk, MSG_ZEROCOPY);
+            else
+                result = apiWrite(gSockets[gCurrent].fd, buffer, gBulk ? MIN(chunk, bytes - total) : chunk); 
+            done = postAPISetup(result);
+        } while (!done);
+        if (gInterrupted)
+            break;
+        calls++;
+        if (result > 0){
+            total += result;
+            gSockets[gCurrent].bytesOut += result;
+        }
+        
+        /*  Keep the error queue from filling up with completions.  */
+        if (zerocopy && result > 0 && ++zc.sends % ZEROCOPY_DRAIN_INTERVAL == 0)
+            drainZerocopy(gSockets[gCurrent].fd, &zc, FALSE);
+    } while (gBulk && result >= 0 && total < bytes && !gInterrupted);
+    gBulk = FALSE;
+    if (sampling)
+        stopTcpSampler(&sampler);
+    
+    if (bytes != 0){
+        if (result < 0 && !gInterrupted)
+            fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+        reportThroughput("written", total, calls, startNs, &startUsage);
+    } else if (gInterrupted){
+        ;
+    } else if (result < 0){
+        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+    } else if (result == 0 && gVerbose)
+        printf("Zero count returned.\n");
+    else if (result > 0 && gVerbose)
+        printf("%d bytes written.\n", result);
+    
+    /*  The buffer can't be reused until the kernel is done with it.  That isn't transfer time.  */
+    if (zerocopy){
+        drainZerocopy(gSockets[gCurrent].fd, &zc, TRUE);
+        reportZerocopy(&zc);
+    }
+    
+    if (buffer != gIOBuffer)
+        free(buffer);
+}
+
+
+/*  
+ *  Parse the options shared by the sendmmsg and recvmmsg commands.  The -a address is 
+ *  returned in faddr, for the caller to free with freeaddrinfo().
+ */
+static int getBatchOptions(enum command_enum cmd, const char *optstring, int *batch, long long *size, 
+                                long *count, struct addrinfo **faddr)
+{
+    int port, retval = 0;
+    char option;
+    long long temp;
+    struct addrinfo hints = {0, 0, 0, 0, 0, NULL, NULL, NULL};
+    
+    *faddr = NULL;
+    *batch = 8;
+    *size = BUFFER_SIZE;
+    *count = 0;
+    gOptind = 0;
+    while (retval == 0 && (option = getOption(gTokenCount, gTokens, optstring)) != -1){
+        switch (option){        
+            case 'a':
+                hints.ai_family = gSockets[gCurrent].domain;
+                hints.ai_socktype = gSockets[gCurrent].type;
+                hints.ai_protocol = gSockets[gCurrent].protocol;
+                if (*faddr != NULL)
+                    freeaddrinfo(*faddr);
+                retval = getaddrinfo(gOptarg, NULL, &hints, faddr);
+                if (retval){
+                    fprintf(stderr, "Error - %s is not a valid address:  %s.\n", gOptarg, gai_strerror(retval));
+                    *faddr = NULL;
+                    break;
+                }
+
+                /*  Translate port number.  */
+                retval = gOptind < gTokenCount ? setIntegerArgument(gTokens[gOptind], &port) : 1;
+                if (retval != 0){
+                    fprintf(stderr, "Invalid port number.\n");
+                    break;
+                }
+                ((struct sockaddr_in6 *)((*faddr)->ai_addr))->sin6_port = htons(port);
+                gOptind += 1;
+                break;          
+            case 'b':
+                retval = setIntegerArgument(gOptarg, batch);
+                break;          
+            case 's':
+                retval = setSizeArgument(gOptarg, size);
+                break;          
+            case 'n':
+                retval = setSizeArgument(gOptarg, &temp);
+                *count = temp;
+                break;          
+            default:
+                fprintf(stderr, "Unknown option %c.\n", option);
+                if (*faddr != NULL)
+                    freeaddrinfo(*faddr);
+                *faddr = NULL;
+                return -1;
+        }
+    }
+    if (gOptind < gTokenCount){
+        fprintf(stderr, "Unexpected argument(s) at end of command.\n");
+        retval = -1;
+    }
+    if (retval == 0 && (*batch < 1 || *batch > UIO_MAXIOV || *size < 1 || *size > 65536 || *count < 0)){
+        fprintf(stderr, "Batch must be 1 to %d messages of 1 to 65536 bytes.\n", UIO_MAXIOV);
+        retval = -1;
+    }
+    if (retval){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[cmd].usage);
+        if (*faddr != NULL)
+            freeaddrinfo(*faddr);
+        *faddr = NULL;
+        return -1;
+    }
+    
+    /*  By default, do one batch.  */
+    if (*count == 0)
+        *count = *batch;
+    return 0;
+}
+
+
+/*  
+ *  Allocate and fill in batch message headers, each with its own buffer of size bytes.  
+ *  Message i is named by the address stride * i bytes into addrs, so with a stride of 0 
+ *  they all share one.
+ */
+static struct mmsghdr *allocBatch(int batch, long long size, void *addrs, socklen_t addrlen, size_t stride)
+{
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    char *buffers;
+    int i;
+    
+    msgs = calloc(batch, sizeof(*msgs) + sizeof(*iovs) + size);
+    if (msgs == NULL){
+        fprintf(stderr, "Unable to allocate %d messages.\n", batch);
+        return NULL;
+    }
+    iovs = (struct iovec *)&msgs[batch];
+    buffers = (char *)&iovs[batch];
+    memset(buffers, '*', batch * size);
+    
+    for (i = 0; i < batch; i++){
+        iovs[i].iov_base = buffers + i * size;
+        iovs[i].iov_len = size;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        if (addrs != NULL){
+            msgs[i].msg_hdr.msg_name = (char *) addrs + i * stride;
+            msgs[i].msg_hdr.msg_namelen = addrlen;
+        }
+    }
+    return msgs;
+}
+
+
+/*  Report the results of a batched transfer.  */
+static void reportPacketRate(const char *what, long packets, long long bytes, long calls, long long startNs, 
+                                struct rusage *startUsage)
 {
-    enum command_enum i;
+    double seconds = (nowNs() - startNs) / 1e9;
     
-    printf("socktest understands these gCommands:\n");
-    for (i =  CMD_QUIT; i <= CMD_CLOSE; i ++)
-        printf("  %s\n", gUsage[i]);
+    if (seconds <= 0)
+        seconds = 1e-9;
+    printf("%ld packets %s in %ld syscalls:  %.0f packets/s, %.0f syscalls/s, %.2f packets/syscall.\n", 
+                packets, what, calls, packets / seconds, calls / seconds, calls ? (double)packets / calls : 0.0);
+    reportThroughput(what, bytes, calls, startNs, startUsage);
 }
 
 
 /*
- *  Implement model command.
+ *  Implement sendmmsg command.
+ *
+ *  sendmmsg [-a hostaddress port] [-b batch] [-s size] [-n count]
  *
- *  model *blocking | nonblocking | select | signal
+ *  Sends count (default batch) messages of size (default 100) bytes, up to batch 
+ *  (default 8) at a time with sendmmsg().
  *
  */
-static void doModel()
+static void doSendmmsg()
 {
-    if (gTokens[1] == NULL)
-        model = BLOCKING_MODEL;
-    else if (strcmp(gTokens[1], "blocking") == 0)
-        model = BLOCKING_MODEL;
-    else if (strcmp(gTokens[1], "nonblocking") == 0)
-        model = NONBLOCKING_MODEL;
-    else if (strcmp(gTokens[1], "signal") == 0)
-        model = SIGNAL_MODEL;
-    else if (strcmp(gTokens[1], "select") == 0)
-        model = SELECT_MODEL;
+    int i, result = 0, done, batch;
+    long long size, bytes = 0, startNs;
+    long count, packets = 0, calls = 0;
+    struct addrinfo *faddr;
+    struct mmsghdr *msgs;
+    struct rusage startUsage;
+    
+    /*  Process command line arguments      */
+    if (getBatchOptions(CMD_SENDMMSG, "a:b:s:n:", &batch, &size, &count, &faddr) != 0)
+        return;
+    if (faddr != NULL)
+        msgs = allocBatch(batch, size, faddr->ai_addr, faddr->ai_addrlen, 0);
     else
-        fprintf(stderr, "Unrecognized model %s\n", gTokens[1]);
+        msgs = allocBatch(batch, size, NULL, 0, 0);
+    if (msgs == NULL){
+        if (faddr != NULL)
+            freeaddrinfo(faddr);
+        return;
+    }
+    
+    /*  Call the API until all the messages are sent.  */
+    gBulk = count > batch;
+    getrusage(RUSAGE_SELF, &startUsage);
+    startNs = nowNs();
+    while (packets < count && !gInterrupted){
+        do {
+            preAPISetup(WRITE_READY);   
+            if (gInterrupted)
+                break;
+            result = sendmmsg(gSockets[gCurrent].fd, msgs, MIN(batch, count - packets), dontWaitFlag());   
+            done = postAPISetup(result);
+        } while (!done);
+        if (gInterrupted)
+            break;
+        calls++;
+        if (result < 0){
+            fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+            break;
+        }
+        for (i = 0; i < result; i++)
+            bytes += msgs[i].msg_len;
+        packets += result;
+    }
+    gBulk = FALSE;
+    gSockets[gCurrent].bytesOut += bytes;
+    
+    reportPacketRate("sent", packets, bytes, calls, startNs, &startUsage);
+    free(msgs);
+    if (faddr != NULL)
+        freeaddrinfo(faddr);
 }
 
 
 /*
- *  Implement use command.
+ *  Implement recvmmsg command.
  *
- *  use number
+ *  recvmmsg [-b batch] [-s size] [-n count]
+ *
+ *  Receives count (default batch) messages of up to size (default 100) bytes, up to
+ *  batch (default 8) at a time with recvmmsg().  Each call returns as soon as one
+ *  message is available (MSG_WAITFORONE).
  *
  */
-static void doUse()
+static void doRecvmmsg()
 {
-    int result, newgCurrent;
+    int i, result = 0, done, batch;
+    long long size, bytes = 0, startNs;
+    long count, packets = 0, calls = 0;
+    struct sockaddr_in6 *addrs;
+    struct addrinfo *faddr;
+    struct mmsghdr *msgs = NULL;
+    struct rusage startUsage;
     
-    /*  Process command line argument       */
-    if (gTokenCount !=2){
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_USE]);
+    /*  Process command line arguments      */
+    if (getBatchOptions(CMD_RECVMMSG, "b:s:n:", &batch, &size, &count, &faddr) != 0)
         return;
-    }
-    
-    result = setIntegerArgument(gTokens[1], &newgCurrent);
-    if (result != 0){
-        fprintf(stderr, "Invalid socket number.\n");
+    addrs = calloc(batch, sizeof(*addrs));
+    if (addrs != NULL)
+        msgs = allocBatch(batch, size, addrs, sizeof(*addrs), sizeof(*addrs));
+    if (msgs == NULL){
+        free(addrs);
         return;
     }
     
-    if (gSockfd[newgCurrent] == UNUSED_FD){
-        fprintf(stderr, "Socket number %d not open.\n", newgCurrent);
-        return;
+    /*  Call the API until all the messages are received.  */
+    gBulk = count > batch;
+    getrusage(RUSAGE_SELF, &startUsage);
+    startNs = nowNs();
+    while (packets < count && !gInterrupted){
+        for (i = 0; i < batch; i++)
+            msgs[i].msg_hdr.msg_namelen = sizeof(*addrs);
+        do {
+            preAPISetup(READ_READY);    
+            if (gInterrupted)
+                break;
+            result = recvmmsg(gSockets[gCurrent].fd, msgs, MIN(batch, count - packets), MSG_WAITFORONE | dontWaitFlag(), NULL);
+            done = postAPISetup(result);
+        } while (!done);
+        if (gInterrupted)
+            break;
+        calls++;
+        if (result < 0){
+            fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+            break;
+        }
+        for (i = 0; i < result; i++)
+            bytes += msgs[i].msg_len;
+        packets += result;
     }
+    gBulk = FALSE;
+    gSockets[gCurrent].bytesIn += bytes;
     
-    gCurrent = newgCurrent;
+    reportPacketRate("received", packets, bytes, calls, startNs, &startUsage);
+    free(msgs);
+    free(addrs);
 }
 
 
 /*
- *  Implement socket command.
+ *  Implement sendfile command.
  *
- *  socket [-d domain] [-t type] [-p protocol]
+ *  sendfile path [-n bytes] [-s chunk] [-p]
+ *
+ *  Streams the file into the gCurrent socket with sendfile(), chunk (default 64k) bytes at
+ *  a time, without copying it through user space.  With -p, the file is instead spliced
+ *  into a pipe and from the pipe into the socket.  bytes defaults to the size of the file;
+ *  if it is larger, the file is sent repeatedly.  The throughput and CPU time are reported.
  *
- *  domain:    number | inet | *inet6
- *  type:      number | *stream | datagram | raw
- *  protocol:  number
  */
-
-static void doSocket()
+static void doSendfile()
 {
-    int i, newgCurrent, retval = 0;
+    int result = 0, done, fileFd, usePipe = FALSE, pipeFds[2] = {UNUSED_FD, UNUSED_FD};
+    int retval = 0, sampling;
     char option;
-    static char *dStrings[] = {"inet", "inet6", NULL};
-    static int dValues[] = {PF_INET, PF_INET6};
-    static char *tStrings[] = {"stream", "datagram", "raw", NULL};
-    static int tValues[] = {SOCK_STREAM, SOCK_DGRAM, SOCK_RAW};
-    static char *pStrings[] = {NULL};
-    static int pValues[] = {0};
-    
-    /*  Set defaults.  */
-    gDomain = PF_INET6;
-    gType = SOCK_STREAM;
-    gProtocol = 0;
+    char *path;
+    struct tcpSampler sampler;
+    long long bytes = 0, chunk = IOBUFFER_SIZE, total = 0, startNs;
+    long calls = 0;
+    loff_t offset = 0;
+    ssize_t inPipe = 0, length;
+    struct stat fileStat;
+    struct rusage startUsage;
     
     /*  Process command line arguments      */
-    optind = 0;
-    while (retval == 0 && (option = getopt(gTokenCount, gTokens, "d:t:p:")) != -1){
+    gOptind = 0;
+    while (retval == 0 && (option = getOption(gTokenCount, gTokens, "n:s:p")) != -1){
         switch (option){        
-            case 'd':
-                retval = getNamedValue(optarg, dStrings, dValues, &gDomain);
+            case 'n':
+                retval = setSizeArgument(gOptarg, &bytes);
                 break;          
-            case 't':
-                retval = getNamedValue(optarg, tStrings, tValues, &gType);
+            case 's':
+                retval = setSizeArgument(gOptarg, &chunk);
                 break;          
             case 'p':
-                retval = getNamedValue(optarg, pStrings, pValues, &gProtocol);
+                usePipe = TRUE;
                 break;          
             default:
                 fprintf(stderr, "Unknown option %c.\n", option);
                 return;
         }
     }
-    if (optind < gTokenCount){
-        fprintf(stderr, "Unexpected argument(s) at end of command.\n");
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_SOCKET]);
+    if (retval || gOptind != gTokenCount - 1 || bytes < 0 || chunk <= 0 || chunk > INT_MAX){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_SENDFILE].usage);
         return;
     }
-    if (retval){
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_SOCKET]);
+    path = gTokens[gOptind];
+    
+    /*  Open the file.  */
+    fileFd = open(path, O_RDONLY);
+    if (fileFd < 0 || fstat(fileFd, &fileStat) < 0){
+        fprintf(stderr, "Error opening %s - %s.\n", path, strerror(errno));
+        if (fileFd >= 0)
+            close(fileFd);
         return;
     }
-    
-    /*  Find a free socket slot.  */
-    newgCurrent = findFreeSocketSlot();
-    if (newgCurrent < 0)
+    if (fileStat.st_size == 0){
+        fprintf(stderr, "%s is empty.\n", path);
+        close(fileFd);
         return;
+    }
+    if (bytes == 0)
+        bytes = fileStat.st_size;
+    
+    /*  Set up the pipe, sized to hold a whole chunk if we are allowed.  */
+    if (usePipe){
+        if (pipe(pipeFds) < 0){
+            fprintf(stderr, "Error creating pipe - %s.\n", strerror(errno));
+            close(fileFd);
+            return;
+        }
+        (void) fcntl(pipeFds[1], F_SETPIPE_SZ, (int)chunk);
+    }
+    
+    /*  Stream the file.  */
+    gBulk = TRUE;
+    sampling = startTcpSampler(&sampler);
+    getrusage(RUSAGE_SELF, &startUsage);
+    startNs = nowNs();
+    while (total < bytes && !gInterrupted){
+        if (offset >= fileStat.st_size)
+            offset = 0;
+        length = MIN(chunk, MIN(bytes - total, fileStat.st_size - offset));
         
-    gCurrent = newgCurrent;
+        /*  Fill the pipe from the file.  */
+        if (usePipe && inPipe == 0){
+            inPipe = splice(fileFd, &offset, pipeFds[1], NULL, length, SPLICE_F_MOVE | SPLICE_F_MORE);
+            calls++;
+            if (inPipe <= 0){
+                result = inPipe;
+                fprintf(stderr, "Error splicing from %s - %s.\n", path, inPipe ? strerror(errno) : "end of file");
+                break;
+            }
+        }
+        
+        do {
+            preAPISetup(WRITE_READY);   
+            if (gInterrupted)
+                break;
+            if (usePipe)
+                result = splice(pipeFds[0], NULL, gSockets[gCurrent].fd, NULL, inPipe, SPLICE_F_MOVE | SPLICE_F_MORE);
+            else
+                result = sendfile(gSockets[gCurrent].fd, fileFd, &offset, length);
+            done = postAPISetup(result);
+        } while (!done);
+        if (gInterrupted)
+            break;
+        calls++;
+        if (result <= 0){
+            if (result < 0)
+                fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+            break;
+        }
+        total += result;
+        gSockets[gCurrent].bytesOut += result;
+        if (usePipe)
+            inPipe -= result;
+    }
+    gBulk = FALSE;
+    if (sampling)
+        stopTcpSampler(&sampler);
     
-    /*  Call the socket() API.  */
-    gSockfd[gCurrent] = socket(gDomain, gType, gProtocol);
-    if (gSockfd[gCurrent] < 0){
-        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", gSockfd[gCurrent], errno, strerror(errno));
-        return;
-    }   
+    reportThroughput("sent", total, calls, startNs, &startUsage);
+    close(fileFd);
+    if (usePipe){
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+    }
+}
+
+
+/*  Move exactly size bytes through a socket slot with the slot's I/O model.  Returns FALSE on failure.  */
+static int transferAll(int slot, char *buffer, long long size, int isWrite)
+{
+    int result = 0, done, saveCurrent = gCurrent;
+    long long total = 0;
+    
+    gCurrent = slot;
+    while (total < size && !gInterrupted){
+        do {
+            preAPISetup(isWrite ? WRITE_READY : READ_READY);
+            if (gInterrupted)
+                break;
+            if (isWrite)
+                result = apiWrite(gSockets[slot].fd, buffer + total, size - total);
+            else
+                result = apiRead(gSockets[slot].fd, buffer + total, size - total);
+            done = postAPISetup(result);
+        } while (!done);
+        if (gInterrupted)
+            break;
+        if (result <= 0){
+            if (result < 0)
+                fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+            else
+                fprintf(stderr, "End of file returned on socket %d.\n", slot);
+            break;
+        }
+        total += result;
+        if (isWrite)
+            gSockets[slot].bytesOut += result;
+        else
+            gSockets[slot].bytesIn += result;
+    }
+    gCurrent = saveCurrent;
+    return total == size;
 }
 
 
 /*
- *  Implement bind command.
+ *  Implement pingpong command.
  *
- *  bind portnumber [ hostaddress ]
+ *  pingpong count size peerSocket
+ *
+ *  Bounces a size byte message from the gCurrent socket to peerSocket and back count
+ *  times, using the I/O model of each socket, and reports the round trip latencies.
  *
  */
-static void doBind()
+static void doPingpong()
 {
-    int result;
-    char option;
-    int port;
-    char buf[80];
-    struct addrinfo *addrInfo;
-    struct addrinfo hints = {0, 0, 0, 0, 0, NULL, NULL, NULL};
-    struct sockaddr_in6 *addr, wildcard = {AF_INET6, 0, 0, IN6ADDR_ANY_INIT, 0};
+    int i, count, size, peer;
+    long long start;
+    char *buffer = gIOBuffer;
+    struct histogram roundTrips;
     
     /*  Process command line arguments      */
-    if (gTokenCount < 2 || gTokenCount > 3){
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_BIND]);
+    if (gTokenCount != 4 || setIntegerArgument(gTokens[1], &count) != 0 || 
+            setIntegerArgument(gTokens[2], &size) != 0 || setIntegerArgument(gTokens[3], &peer) != 0){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_PINGPONG].usage);
         return;
     }
-    
-    result = setIntegerArgument(gTokens[1], &port);
-    if (result != 0){
-        fprintf(stderr, "Invalid port number.\n");
+    if (count < 1 || size < 1 || size > IOBUFFER_SIZE){
+        fprintf(stderr, "count must be positive and size between 1 and %d.\n", IOBUFFER_SIZE);
         return;
     }
-    
-    if (gTokenCount == 3){
-        /*  Translate/lookup host address/name.  */
-        hints.ai_family = gDomain;
-        hints.ai_socktype = gType;
-        hints.ai_protocol = gProtocol;
-        result = getaddrinfo(gTokens[2], NULL, &hints, &addrInfo);
-        if (result){
-            fprintf(stderr, "Error - %s is not a valid address:  %s.\n", gTokens[2], gai_strerror(result));
-            return;
-        }
-        addr = (struct sockaddr_in6 *)addrInfo->ai_addr;
-    }
-    else {
-        addr = &wildcard;
+    if (peer < 0 || peer >= gSocketSlots || gSockets[peer].fd == UNUSED_FD || peer == gCurrent){
+        fprintf(stderr, "Socket number %d not open.\n", peer);
+        return;
     }
+    memset(buffer, '*', size);
+    histReset(&roundTrips);
     
-    /*  Plug the port number into the address.  */
-#ifdef SOLARIS
-    assert(offsetof(struct sockaddr_in, sin_port) == offsetof(struct sockaddr_in6, sin6_port));
-#endif
-    addr->sin6_port = htons(port);
-    
-    /*  Call the bind() API.  */
-    result = bind(gSockfd[gCurrent], (struct sockaddr *)addr, sizeof(*addr));
-    if (result < 0){
-        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+    /*  Bounce the message.  */
+    gBulk = TRUE;
+    for (i = 0; i < count && !gInterrupted; i++){
+        start = nowNs();
+        if (!transferAll(gCurrent, buffer, size, TRUE) || !transferAll(peer, buffer, size, FALSE) ||
+                !transferAll(peer, buffer, size, TRUE) || !transferAll(gCurrent, buffer, size, FALSE))
+            break;
+        histRecord(&roundTrips, nowNs() - start);
+    }
+    gBulk = FALSE;
+    if (roundTrips.count == 0)
         return;
-    }   
+    
+    /*  Report the distribution.  */
+    printf("%lld round trips of %d bytes:\n", roundTrips.count, size);
+    histPrintHeader("");
+    histPrintLine("round trip ns", &roundTrips);
+    histPrintDistribution(&roundTrips);
 }
 
 
 /*
- *  Implement connect command.
+ *  Implement stats command.
  *
- *  connect portnumber [ hostaddress ]
+ *  stats [reset]
+ *
+ *  Shows the distribution of API latencies, in ns, for each command in each model, and 
+ *  of the run time of commands that call no timed API.
  *
  */
-static void doConnect()
+static void doStats()
 {
-    int result, done;
-    char option;
-    int port;
-    char buf[80];
-    struct addrinfo *addrInfo;
-    struct addrinfo hints = {0, 0, 0, 0, 0, NULL, NULL, NULL};
-
-    /*  Process command line arguments      */
-    if (gTokenCount < 2 || gTokenCount > 3){
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_CONNECT]);
-        return;
-    }
+    enum command_enum cmd;
+    enum model_enum m;
+    char label[40];
+    int headerPrinted = FALSE;
     
-    result = setIntegerArgument(gTokens[1], &port);
-    if (result != 0){
-        fprintf(stderr, "Invalid port number.\n");
+    if (gTokenCount > 2 || (gTokenCount == 2 && strcasecmp(gTokens[1], "reset") != 0)){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_STATS].usage);
         return;
     }
     
-    /*  Translate/lookup host address/name.  */
-    hints.ai_family = gDomain;
-    hints.ai_socktype = gType;
-    hints.ai_protocol = gProtocol;
-    result = getaddrinfo(gTokens[2], NULL, &hints, &addrInfo);
-    if (result){
-        fprintf(stderr, "Error - %s is not a valid address:  %s.\n", gTokens[2], gai_strerror(result));
-        return;
+    for (cmd = 0; cmd < NUM_COMMANDS; cmd++){
+        for (m = 0; m < NUM_MODELS; m++){
+            if (gHistograms[cmd][m] == NULL || gHistograms[cmd][m]->count == 0)
+                continue;
+            if (gTokenCount == 2){
+                histReset(gHistograms[cmd][m]);
+                gBlocked[cmd][m] = 0;
+                continue;
+            }
+            if (!headerPrinted){
+                histPrintHeader("command/model");
+                headerPrinted = TRUE;
+            }
+            snprintf(label, sizeof(label), "%s/%s", gCommandTable[cmd].name, gModelNames[m]);
+            histPrintLine(label, gHistograms[cmd][m]);
+            if (gBlocked[cmd][m] != 0)
+                printf("%-24s %10ld blocked\n", "", gBlocked[cmd][m]);
+        }
     }
     
-    /*  Plug the port number into the address.  */
-#ifdef SOLARIS
-    assert(offsetof(struct sockaddr_in, sin_port) == offsetof(struct sockaddr_in6, sin6_port));
-#endif
-    ((struct sockaddr_in6 *)(addrInfo->ai_addr))->sin6_port = htons(port);
+    /*  Commands timed as a whole.  */
+    for (cmd = 0, headerPrinted = FALSE; cmd < NUM_COMMANDS; cmd++){
+        if (gCommandTimes[cmd] == NULL || gCommandTimes[cmd]->count == 0)
+            continue;
+        if (gTokenCount == 2){
+            histReset(gCommandTimes[cmd]);
+            continue;
+        }
+        if (!headerPrinted){
+            histPrintHeader("command run time");
+            headerPrinted = TRUE;
+        }
+        histPrintLine(gCommandTable[cmd].name, gCommandTimes[cmd]);
+    }
     
-    /*  Call the connect() API.  */
-    do {
-        preAPISetup(READ_READY);    
-        if (gInterrupted)
-            return;
-        result = connect(gSockfd[gCurrent], addrInfo->ai_addr, sizeof(struct sockaddr_in6));
-        done = postAPISetup(result);
-    } while (!done);
-
+    /*  accept -d batches.  */
+    if (gAcceptBatches != NULL && gAcceptBatches->count != 0){
+        if (gTokenCount == 2){
+            histReset(gAcceptBatches);
+            gFcntlSaved = 0;
+        } else {
+            histPrintHeader("connections/wakeup");
+            histPrintLine("accept -d", gAcceptBatches);
+            printf("%-24s %10ld fcntl calls saved\n", "", gFcntlSaved);
+        }
+    }
     
-    /*  Call the connect() API.  */
-    if (result < 0){
-        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
-        return;
-    }   
+    /*  rtsignal delivery latency.  */
+    if (gSignalLatency != NULL && gSignalLatency->count != 0){
+        if (gTokenCount == 2)
+            histReset(gSignalLatency);
+        else {
+            histPrintHeader("signal delivery ns");
+            histPrintLine("send to rtsignal", gSignalLatency);
+        }
+    }
 }
 
 
 /*
- *  Implement listen command.
- *
- *  listen [backlogCount]
- *
- *  Backlog defaults to 1 if not specified.
- *
+ *  Socket options by name.  Each option's level, number and value type are in one table,
+ *  and each type has a parser and a printer, so options are scripted by name rather than
+ *  by level and number, with values in their natural units.
  */
-static void doListen()
+enum optionType {
+    INT_OPTION,                              /*  Integer, k, m or g suffix allowed  */
+    BOOL_OPTION,                             /*  on | off  */
+    LINGER_OPTION,                           /*  off | seconds  */
+    TIMEVAL_OPTION,                          /*  Duration  */
+    STRING_OPTION,                           /*  Such as a congestion algorithm or device  */
+    U64_OPTION                               /*  64 bit integer, such as a rate in bytes/s  */
+};
+
+struct socketOption {
+    char *name;
+    int level;
+    int opt;
+    enum optionType type;
+};
+
+static const struct socketOption gSocketOptions[] = {
+    {"so_sndbuf",           SOL_SOCKET,   SO_SNDBUF,           INT_OPTION},
+    {"so_rcvbuf",           SOL_SOCKET,   SO_RCVBUF,           INT_OPTION},
+    {"so_sndbufforce",      SOL_SOCKET,   SO_SNDBUFFORCE,      INT_OPTION},
+    {"so_rcvbufforce",      SOL_SOCKET,   SO_RCVBUFFORCE,      INT_OPTION},
+    {"so_rcvlowat",         SOL_SOCKET,   SO_RCVLOWAT,         INT_OPTION},
+    {"so_reuseaddr",        SOL_SOCKET,   SO_REUSEADDR,        BOOL_OPTION},
+    {"so_reuseport",        SOL_SOCKET,   SO_REUSEPORT,        BOOL_OPTION},
+    {"so_keepalive",        SOL_SOCKET,   SO_KEEPALIVE,        BOOL_OPTION},
+    {"so_linger",           SOL_SOCKET,   SO_LINGER,           LINGER_OPTION},
+    {"so_rcvtimeo",         SOL_SOCKET,   SO_RCVTIMEO,         TIMEVAL_OPTION},
+    {"so_sndtimeo",         SOL_SOCKET,   SO_SNDTIMEO,         TIMEVAL_OPTION},
+    {"so_bindtodevice",     SOL_SOCKET,   SO_BINDTODEVICE,     STRING_OPTION},
+    {"so_priority",         SOL_SOCKET,   SO_PRIORITY,         INT_OPTION},
+    {"so_mark",             SOL_SOCKET,   SO_MARK,             INT_OPTION},
+    {"so_zerocopy",         SOL_SOCKET,   SO_ZEROCOPY,         BOOL_OPTION},
+    {"so_incoming_cpu",     SOL_SOCKET,   SO_INCOMING_CPU,     INT_OPTION},
+    {"so_max_pacing_rate",  SOL_SOCKET,   SO_MAX_PACING_RATE,  U64_OPTION},
+    {"so_busy_poll",        SOL_SOCKET,   SO_BUSY_POLL,        INT_OPTION},
+    {"so_prefer_busy_poll", SOL_SOCKET,   SO_PREFER_BUSY_POLL, BOOL_OPTION},
+    {"so_busy_poll_budget", SOL_SOCKET,   SO_BUSY_POLL_BUDGET, INT_OPTION},
+    {"tcp_nodelay",         IPPROTO_TCP,  TCP_NODELAY,         BOOL_OPTION},
+    {"tcp_cork",            IPPROTO_TCP,  TCP_CORK,            BOOL_OPTION},
+    {"tcp_quickack",        IPPROTO_TCP,  TCP_QUICKACK,        BOOL_OPTION},
+    {"tcp_congestion",      IPPROTO_TCP,  TCP_CONGESTION,      STRING_OPTION},
+    {"tcp_maxseg",          IPPROTO_TCP,  TCP_MAXSEG,          INT_OPTION},
+    {"tcp_notsent_lowat",   IPPROTO_TCP,  TCP_NOTSENT_LOWAT,   INT_OPTION},
+    {"tcp_window_clamp",    IPPROTO_TCP,  TCP_WINDOW_CLAMP,    INT_OPTION},
+    {"tcp_keepidle",        IPPROTO_TCP,  TCP_KEEPIDLE,        INT_OPTION},
+    {"tcp_keepintvl",       IPPROTO_TCP,  TCP_KEEPINTVL,       INT_OPTION},
+    {"tcp_keepcnt",         IPPROTO_TCP,  TCP_KEEPCNT,         INT_OPTION},
+    {"tcp_user_timeout",    IPPROTO_TCP,  TCP_USER_TIMEOUT,    INT_OPTION},
+    {"tcp_defer_accept",    IPPROTO_TCP,  TCP_DEFER_ACCEPT,    INT_OPTION},
+    {"tcp_fastopen",        IPPROTO_TCP,  TCP_FASTOPEN,        INT_OPTION},
+    {"ip_tos",              IPPROTO_IP,   IP_TOS,              INT_OPTION},
+    {"ip_ttl",              IPPROTO_IP,   IP_TTL,              INT_OPTION},
+    {"ip_multicast_ttl",    IPPROTO_IP,   IP_MULTICAST_TTL,    INT_OPTION},
+    {"ip_multicast_loop",   IPPROTO_IP,   IP_MULTICAST_LOOP,   BOOL_OPTION},
+    {"ip_multicast_all",    IPPROTO_IP,   IP_MULTICAST_ALL,    BOOL_OPTION},
+    {"ipv6_tclass",         IPPROTO_IPV6, IPV6_TCLASS,         INT_OPTION},
+    {"ipv6_unicast_hops",   IPPROTO_IPV6, IPV6_UNICAST_HOPS,   INT_OPTION},
+    {"ipv6_multicast_hops", IPPROTO_IPV6, IPV6_MULTICAST_HOPS, INT_OPTION},
+    {"ipv6_multicast_loop", IPPROTO_IPV6, IPV6_MULTICAST_LOOP, BOOL_OPTION},
+    {"ipv6_multicast_all",  IPPROTO_IPV6, IPV6_MULTICAST_ALL,  BOOL_OPTION},
+    {"ipv6_v6only",         IPPROTO_IPV6, IPV6_V6ONLY,         BOOL_OPTION},
+    {NULL}
+};
+
+#define NUM_SOCKET_OPTIONS  (sizeof(gSocketOptions) / sizeof(gSocketOptions[0]) - 1)
+#define MAX_OPTION_STRING   64
+
+/*  Any option's value.  */
+union optionValue {
+    int i;
+    struct linger linger;
+    struct timeval tv;
+    char string[MAX_OPTION_STRING];
+    unsigned long long u64;
+};
+
+static struct nameIndex gSocketOptionIndex;
+
+/*  Levels for the numeric form.  */
+static const struct namedValue gOptionLevels[] = {
+    {"sol_socket", SOL_SOCKET}, {"ipproto_ip", IPPROTO_IP}, {"ipproto_ipv6", IPPROTO_IPV6}, 
+    {"ipproto_tcp", IPPROTO_TCP}, {"ipproto_udp", IPPROTO_UDP}, {NULL}
+};
+static struct nameIndex gOptionLevelIndex;
+
+
+/*  Find a named socket option, or return NULL.  */
+static const struct socketOption *findSocketOption(const char *name)
 {
-    int result;
-    int backlog = 1;
+    int i;
     
-    /*  Process command line arguments      */
-    if (gTokenCount > 2){
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_LISTEN]);
-        return;
+    /*  Workers may get here together, so the index is built under a lock.  */
+    if (__atomic_load_n(&gSocketOptionIndex.slots, __ATOMIC_ACQUIRE) == NULL){
+        pthread_mutex_lock(&gNameIndexLock);
+        i = gSocketOptionIndex.slots == NULL ? 
+                buildNameIndex(&gSocketOptionIndex, &gSocketOptions[0].name, sizeof(gSocketOptions[0]), 
+                                NUM_SOCKET_OPTIONS) : 0;
+        pthread_mutex_unlock(&gNameIndexLock);
+        if (i != 0){
+            fprintf(stderr, "Unable to index option names.\n");
+            return NULL;
+        }
     }
+    i = lookupName(&gSocketOptionIndex, &gSocketOptions[0].name, sizeof(gSocketOptions[0]), name);
+    return i < 0 ? NULL : &gSocketOptions[i];
+}
+
+
+/*  Parse a value for an option into value, and set its length.  */
+static int parseOptionValue(const struct socketOption *option, char *token, union optionValue *value,
+                                socklen_t *length)
+{
+    long long number;
+    int retval = 0;
+    static const struct namedValue bools[] = {
+        {"on", 1}, {"off", 0}, {"true", 1}, {"false", 0}, {"yes", 1}, {"no", 0}, {NULL}
+    };
+    static struct nameIndex boolIndex;
     
-    if (gTokenCount == 2){
-        result = setIntegerArgument(gTokens[1], &backlog);
-        if (result != 0){
-            fprintf(stderr, "Invalid backlog count.\n");
-                return;
-        }
+    memset(value, 0, sizeof(*value));
+    switch (option->type){
+        case INT_OPTION:
+            retval = setSizeArgument(token, &number);
+            if (retval == 0 && (number < INT_MIN || number > INT_MAX)){
+                fprintf(stderr, "%s is out of range.\n", token);
+                retval = 1;
+            }
+            value->i = number;
+            *length = sizeof(value->i);
+            break;
+        case BOOL_OPTION:
+            retval = getNamedValue(token, bools, &boolIndex, &value->i);
+            *length = sizeof(value->i);
+            break;
+        case LINGER_OPTION:
+            if (strcasecmp(token, "off") != 0){
+                value->linger.l_onoff = 1;
+                retval = setIntegerArgument(token, &value->linger.l_linger);
+            }
+            *length = sizeof(value->linger);
+            break;
+        case TIMEVAL_OPTION:
+            retval = setDurationArgument(token, &number);
+            value->tv.tv_sec = number / 1000000000;
+            value->tv.tv_usec = number % 1000000000 / 1000;
+            *length = sizeof(value->tv);
+            break;
+        case STRING_OPTION:
+            if (strlen(token) >= sizeof(value->string)){
+                fprintf(stderr, "%s is too long.\n", token);
+                retval = 1;
+            }
+            strncpy(value->string, token, sizeof(value->string) - 1);
+            *length = strlen(value->string);
+            break;
+        case U64_OPTION:
+            retval = setSizeArgument(token, &number);
+            value->u64 = number;
+            *length = sizeof(value->u64);
+            break;
+    }
+    return retval;
+}
+
+
+/*  Print an option's value, as returned by getsockopt().  */
+static void printOptionValue(const struct socketOption *option, const union optionValue *value, socklen_t length)
+{
+    printf("%s = ", option->name);
+    switch (option->type){
+        case INT_OPTION:
+            printf("%d\n", value->i);
+            break;
+        case BOOL_OPTION:
+            printf("%s\n", value->i ? "on" : "off");
+            break;
+        case LINGER_OPTION:
+            if (value->linger.l_onoff)
+                printf("%d s\n", value->linger.l_linger);
+            else
+                printf("off\n");
+            break;
+        case TIMEVAL_OPTION:
+            printf("%ld.%06ld s\n", (long) value->tv.tv_sec, (long) value->tv.tv_usec);
+            break;
+        case STRING_OPTION:
+            printf("%.*s\n", (int) strnlen(value->string, length), value->string);
+            break;
+        case U64_OPTION:
+            printf("%llu\n", length == sizeof(unsigned) ? *(const unsigned *) value : value->u64);
+            break;
     }
+}
 
-    /*  Call the listen() API.  */
-    result = listen(gSockfd[gCurrent], backlog);
-    if (result < 0){
-        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
-        return;
-    }   
+
+/*  Get a named option from the gCurrent socket and print it.  */
+static int getNamedOption(const struct socketOption *option)
+{
+    union optionValue value;
+    socklen_t length = sizeof(value);
+    int result;
+    
+    memset(&value, 0, sizeof(value));
+    result = getsockopt(gSockets[gCurrent].fd, option->level, option->opt, &value, &length);
+    if (result < 0)
+        return result;
+    printOptionValue(option, &value, length);
+    return 0;
 }
 
 
 /*
- *  Implement accept command.
+ *  Implement setsockopt command.
  *
- *  accept 
+ *  setsockopt name value | level opt -i value
+ *
+ *  name is a socket option such as so_linger or tcp_congestion, in any case, and its 
+ *  value is on | off, a number (k, m, g), seconds to linger or off, a duration or a string
+ *  as fits the option.  The numeric form sets an int, and level may be named.
  *
  */
-static void doAccept()
+static void doSetsockopt()
 {
-    int result, newgCurrent;
-    struct sockaddr_in6 saddr;
-    socklen_t len = sizeof(saddr);
-    int done;
+    int result, level, opt, intArg;
+    const struct socketOption *option;
+    union optionValue value;
+    socklen_t length;
     
-    /*  Find a free socket slot.  */
-    newgCurrent = findFreeSocketSlot();
-    if (newgCurrent < 0)
+    /*  A named option.  */
+    if (gTokenCount == 3){
+        option = findSocketOption(gTokens[1]);
+        if (option == NULL){
+            fprintf(stderr, "Unknown socket option %s.\n", gTokens[1]);
+            return;
+        }
+        if (parseOptionValue(option, gTokens[2], &value, &length) != 0){
+            fprintf(stderr, "Invalid %s value.\n", option->name);
+            return;
+        }
+        result = setsockopt(gSockets[gCurrent].fd, option->level, option->opt, &value, length);   
+        if (result < 0)
+            fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+        return;
+    }
+    
+    /*  Process command line arguments      */
+    if (gTokenCount != 5){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_SETSOCKOPT].usage);
         return;
+    }
+    
+    result = getNamedValue(gTokens[1], gOptionLevels, &gOptionLevelIndex, &level);
+    if (result != 0){
+        fprintf(stderr, "Invalid level value.\n");
+            return;
+    }
         
-    /*  Call the API.  */
-    do {
-        preAPISetup(READ_READY);    
-        if (gInterrupted)
+    result = setIntegerArgument(gTokens[2], &opt);
+    if (result != 0){
+        fprintf(stderr, "Invalid opt value.\n");
             return;
-        result = accept(gSockfd[gCurrent], (struct sockaddr *)&saddr, &len);    
-        done = postAPISetup(result);
-    } while (!done);
+    }
+        
+    result = setIntegerArgument(gTokens[4], &intArg);
+    if (result != 0){
+        fprintf(stderr, "Invalid argument value.\n");
+            return;
+    }
+        
+    /*  Call the API.  */
+    result = setsockopt(gSockets[gCurrent].fd, level, opt, &intArg, sizeof(int));   
     if (result < 0){
         fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
         return;
-    }   
-
-    /*  Update our state.  */
-    gSockfd[newgCurrent] = result;
-    gCurrent = newgCurrent;
+    } 
 }
 
 
 /*
- *  Implement recvmsg command.
+ *  Implement getsockopt command.
  *
- *  recvmsg [-f OOB]
+ *  getsockopt [name | level opt -i] 
+ *
+ *  Without arguments, shows every named option the gCurrent socket has.
  *
  */
-static void doRecvmsg()
+static void doGetsockopt()
 {
-    int result;
-    char option;
-    int done, flags = 0;
-    struct msghdr msgInfo;
-    struct iovec iov;
-    char buffer[BUFFER_SIZE];
-    struct sockaddr_in6 saddr;
-    char temp[100];
-    char hexBuffer[MAX_DATA_DISPLAY*3 + 1];
-    int i, bytesToDisplay, retval = 0;
-    static char *fStrings[] = {"oob", NULL};
-    static int fValues[] = {MSG_OOB};
-    int atMark;
-        
-    /*  Process command line arguments      */
-    optind = 0;
-    while (retval == 0 && (option = getopt(gTokenCount, gTokens, "f:")) != -1){
-        switch (option){        
-            case 'f':
-                retval = getNamedValue(optarg, fStrings, fValues, &flags);
-                break;          
-            default:
-                fprintf(stderr, "Unknown option %c.\n", option);
-                return;
-        }
-    }
-    if (optind < gTokenCount){
-        fprintf(stderr, "Unexpected argument(s) at end of command.\n");
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_RECVMSG]);
+    int result, level, opt, intArg;
+    socklen_t optlen;
+    const struct socketOption *option;
+    
+    /*  Every named option, skipping those that don't apply to this socket.  */
+    if (gTokenCount == 1){
+        for (option = gSocketOptions; option->name != NULL; option++)
+            (void) getNamedOption(option);
         return;
     }
-    if (retval){
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_RECVMSG]);
+    
+    /*  A named option.  */
+    if (gTokenCount == 2){
+        option = findSocketOption(gTokens[1]);
+        if (option == NULL){
+            fprintf(stderr, "Unknown socket option %s.\n", gTokens[1]);
+            return;
+        }
+        result = getNamedOption(option);
+        if (result < 0)
+            fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
         return;
     }
-
-    /*  Fill in the msghdr.  */
-    iov.iov_base = buffer;
-    iov.iov_len = sizeof(buffer);
-    msgInfo.msg_name = &saddr;
-    msgInfo.msg_namelen = sizeof(saddr);
-    msgInfo.msg_iov = &iov;
-    msgInfo.msg_iovlen = 1;
-    msgInfo.msg_control = NULL;
-    msgInfo.msg_controllen = 0;
-    msgInfo.msg_flags = 0;
     
-    /*  Call the API.  */
-    do {
-        preAPISetup(READ_READY);    
-        if (gInterrupted)
-            return;
-        result = recvmsg(gSockfd[gCurrent], &msgInfo, flags);
-        done = postAPISetup(result);
-    } while (!done);
-    if (result < 0){
-        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+    /*  Process command line arguments      */
+    if (gTokenCount != 4){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_GETSOCKOPT].usage);
         return;
     }
     
-    if (gVerbose){
+    result = getNamedValue(gTokens[1], gOptionLevels, &gOptionLevelIndex, &level);
+    if (result != 0){
+        fprintf(stderr, "Invalid level value.\n");
+            return;
+    }
         
-        if (result == 0)
-            printf("End of file returned.\n");
-        else 
-            printf("%d bytes read.\n", result);
-        if (gType != SOCK_STREAM)
-            fprintf(stdout, "Source address = %s.\n", inet_ntop(gDomain, &saddr.sin6_addr, 
-                (char *)&temp, sizeof(temp)));              
-
-        bytesToDisplay = MIN(result, MAX_DATA_DISPLAY);
-        for (i = 0; i < bytesToDisplay; i++){
-            snprintf(temp, sizeof(temp), "%.8x ", (unsigned)buffer[i]);
-            strncpy(&hexBuffer[i*3], &temp[6], 3);
-        }
-        hexBuffer[i*3] = '\0';
-        printf("First %d bytes received are: %s\n", bytesToDisplay, hexBuffer);
+    result = setIntegerArgument(gTokens[2], &opt);
+    if (result != 0){
+        fprintf(stderr, "Invalid opt value.\n");
+            return;
     }
     
-    result = ioctl(gSockfd[gCurrent], SIOCATMARK, &atMark);
+    optlen = sizeof(int);
+        
+    /*  Call the API.  */
+    result = getsockopt(gSockets[gCurrent].fd, level, opt, &intArg, &optlen);   
     if (result < 0){
-        fprintf(stderr, "Error in ioctl(SIOCATMARK) call - %s.\n", strerror(errno));
+        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
         return;
-    }
-    if (atMark)
-        fprintf(stdout, "SIOCATMARK returned true.\n");
+    } 
+    
+    printf("Option value = %d, option length = %d.\n", intArg, (int) optlen);
 }
 
 
 /*
- *  Implement sendmsg command.
+ *  Implement tcpinfo command.
  *
- *  sendmsg [-a hostaddress port] [-f OOB]
+ *  tcpinfo [-i interval] [-x csv | json] [-o file]
  *
- *  ??  This is a first cut.  
+ *  Without options, shows the gCurrent socket's tcp_info.  -i samples it every interval 
+ *  during each bulk write or sendfile from now on (0 stops sampling), and -x exports the
+ *  samples from the last one, to stdout or -o file.  Times are in us and rates in bytes/s.
  *
  */
-static void doSendmsg()
+static void doTcpinfo()
 {
-    int i, result, done;
-    char option;
-    struct msghdr msgInfo;
-    struct iovec iov;
-    char buffer[BUFFER_SIZE];
-    struct addrinfo *addrInfo;
-    struct addrinfo hints = {0, 0, 0, 0, 0, NULL, NULL, NULL};
-    struct sockaddr_in6 *faddr = NULL;
-    int port, flags = 0, retval = 0;
-    static char *fStrings[] = {"oob", NULL};
-    static int fValues[] = {MSG_OOB};
-
+    int retval = 0, format = -1;
+    long i, first;
+    long long interval = -1;
+    char option, *path = NULL;
+    struct tcpSample sample, *s;
+    FILE *file = stdout;
+    static const struct namedValue formats[] = {{"csv", 0}, {"json", 1}, {NULL}};
+    static struct nameIndex formatIndex;
+    
     /*  Process command line arguments      */
-    optind = 0;
-    while (retval == 0 && (option = getopt(gTokenCount, gTokens, "a:f:")) != -1){
+    gOptind = 0;
+    while (retval == 0 && (option = getOption(gTokenCount, gTokens, "i:x:o:")) != -1){
         switch (option){        
-            case 'a':
-                hints.ai_family = gDomain;
-                hints.ai_socktype = gType;
-                hints.ai_protocol = gProtocol;
-                retval = getaddrinfo(optarg, NULL, &hints, &addrInfo);
-                if (retval)
-                    fprintf(stderr, "Error - %s is not a valid address:  %s.\n", optarg, gai_strerror(result));
-
-                /*  Translate port number.  */
-                retval = setIntegerArgument(gTokens[optind], &port);
-                if (retval != 0)
-                    fprintf(stderr, "Invalid port number.\n");
-                ((struct sockaddr_in6 *)(addrInfo->ai_addr))->sin6_port = htons(port);
-
-                faddr = (struct sockaddr_in6 *)(addrInfo->ai_addr);
-                optind += 1;
+            case 'i':
+                retval = setDurationArgument(gOptarg, &interval);
                 break;          
-            case 'f':
-                retval = getNamedValue(optarg, fStrings, fValues, &flags);
+            case 'x':
+                retval = getNamedValue(gOptarg, formats, &formatIndex, &format);
+                break;          
+            case 'o':
+                path = gOptarg;
                 break;          
             default:
-                fprintf(stderr, "Unknown option %c.\n", option);
-                return;
+                retval = 1;
+                break;
         }
     }
-    if (optind < gTokenCount){
-        fprintf(stderr, "Unexpected argument(s) at end of command.\n");
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_SENDMSG]);
-        return;
-    }
-    if (retval){
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_SENDMSG]);
+    if (retval || gOptind != gTokenCount || (path != NULL && format < 0)){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_TCPINFO].usage);
         return;
     }
     
-    /*  Fill in the msghdr.  */
-    iov.iov_base = buffer;
-    iov.iov_len = sizeof(buffer);
-    msgInfo.msg_name = faddr;
-    msgInfo.msg_namelen = (faddr != NULL) ? sizeof(struct sockaddr_in6) : 0;
-    msgInfo.msg_iov = &iov;
-    msgInfo.msg_iovlen = 1;
-    msgInfo.msg_control = NULL;
-    msgInfo.msg_controllen = 0;
-    msgInfo.msg_flags = 0;
-    
-    /*  Fill the buffer.  */
-    for (i = 0; i < BUFFER_SIZE; i++)
-        buffer[i] = '*';
+    if (interval >= 0)
+        gTcpInfoIntervalNs = interval;
     
-    /*  Call the API.  */
-    do {
-        preAPISetup(WRITE_READY);   
-        if (gInterrupted)
+    /*  Show the socket's state now.  */
+    if (interval < 0 && format < 0){
+        if (readTcpSample(gSockets[gCurrent].fd, nowNs(), &sample) < 0){
+            fprintf(stderr, "Error reading TCP_INFO - %s.\n", strerror(errno));
             return;
-        result = sendmsg(gSockfd[gCurrent], &msgInfo, flags);   
-        done = postAPISetup(result);
-    } while (!done);
-    if (result < 0){
-        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
+        }
+        printf("rtt %u us, rttvar %u us, cwnd %u, retransmits %u, pacing rate %llu B/s, delivery rate %llu B/s.\n",
+                    sample.rtt, sample.rttvar, sample.cwnd, sample.retransmits, sample.pacingRate, 
+                    sample.deliveryRate);
+        printf("busy %llu us, rwnd limited %llu us, sndbuf limited %llu us, %llu bytes acked.\n", 
+                    sample.busy, sample.rwndLimited, sample.sndbufLimited, sample.bytesAcked);
         return;
-    } else if (result == 0 && gVerbose)
-        printf("Zero count returned.\n");
-    else if (result > 0 && gVerbose)
-        printf("%d bytes written.\n", result);
+    }
+    if (format < 0)
+        return;
+    
+    /*  Export the samples, oldest first.  */
+    if (gTcpSampleCount == 0){
+        fprintf(stderr, "No tcp_info samples - use tcpinfo -i before a bulk write.\n");
+        return;
+    }
+    if (path != NULL && (file = fopen(path, "w")) == NULL){
+        fprintf(stderr, "Error opening %s - %s.\n", path, strerror(errno));
+        return;
+    }
+    first = gTcpSampleCount > TCPINFO_SAMPLES ? gTcpSampleCount - TCPINFO_SAMPLES : 0;
+    if (format == 0)
+        fprintf(file, "ns,rtt,rttvar,cwnd,retransmits,pacing_rate,delivery_rate,busy,rwnd_limited,sndbuf_limited,bytes_acked\n");
+    else
+        fprintf(file, "[\n");
+    for (i = first; i < gTcpSampleCount; i++){
+        s = &gTcpSamples[i % TCPINFO_SAMPLES];
+        if (format == 0)
+            fprintf(file, "%lld,%u,%u,%u,%u,%llu,%llu,%llu,%llu,%llu,%llu\n", s->ns, s->rtt, s->rttvar, s->cwnd, 
+                        s->retransmits, s->pacingRate, s->deliveryRate, s->busy, s->rwndLimited, 
+                        s->sndbufLimited, s->bytesAcked);
+        else
+            fprintf(file, "  {\"ns\": %lld, \"rtt\": %u, \"rttvar\": %u, \"cwnd\": %u, \"retransmits\": %u, "
+                        "\"pacing_rate\": %llu, \"delivery_rate\": %llu, \"busy\": %llu, \"rwnd_limited\": %llu, "
+                        "\"sndbuf_limited\": %llu, \"bytes_acked\": %llu}%s\n", s->ns, s->rtt, s->rttvar, s->cwnd, 
+                        s->retransmits, s->pacingRate, s->deliveryRate, s->busy, s->rwndLimited, 
+                        s->sndbufLimited, s->bytesAcked, i + 1 < gTcpSampleCount ? "," : "");
+    }
+    if (format == 1)
+        fprintf(file, "]\n");
+    if (path != NULL){
+        fclose(file);
+        printf("%ld samples written to %s.\n", gTcpSampleCount - first, path);
+    }
 }
 
 
 /*
- *  Implement read command.
+ *  Implement sweep command.
  *
- *  read 
+ *  sweep port bytes name value[/value...] ... [-s chunk] [-r roundtrips] [-a hostaddress]
  *
- *  ??  This is a first cut.  Such nicities as showing what was read and giving the user 
- *  ??  options is left for another day.
+ *  For every combination of the named socket options' values (as setsockopt takes 
+ *  them), sets up a fresh connection on the port with the socket, setsockopt, bind, 
+ *  listen, connect and accept commands, with the options set on the listener and the 
+ *  connecting socket, then sends bytes (in chunk writes) and times roundtrips (default 
+ *  10) 64 byte round trips.  A thread reads at the other end and echoes the round trips.
+ *  Shows the throughput and round trip latency of each configuration, and which was 
+ *  fastest.
  *
  */
-static void doRead()
+#define MAX_SWEEP_OPTIONS   8
+#define MAX_SWEEP_VALUES    16
+#define SWEEP_MESSAGE_SIZE  64
+
+struct sweepOption {
+    const struct socketOption *option;
+    char *text;                              /*  Copy of the values  */
+    char *values[MAX_SWEEP_VALUES];
+    int count;
+};
+
+struct sweepReader {
+    pthread_t thread;
+    int fd;
+    long long bytes;                         /*  Bulk data to read before echoing  */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    long long received;
+    int drained;                             /*  Done with the bulk data, all of it or not  */
+};
+
+
+/*  Read the bulk data, then echo messages back until end of file.  */
+static void *sweepReaderThread(void *arg)
 {
-    int result;
-    int done;
-    char buffer[BUFFER_SIZE];
-    char temp[100];
-    char hexBuffer[MAX_DATA_DISPLAY*3 + 1];
-    int i, bytesToDisplay;
-    
-    /*  Call the API.  */
-    do {
-        preAPISetup(READ_READY);    
-        if (gInterrupted)
-            return;
-        result = read(gSockfd[gCurrent], buffer, BUFFER_SIZE);  
-        done = postAPISetup(result);
-    } while (!done);
-    if (result < 0){
-        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
-        return;
-    } else if (gVerbose){
-        if(result == 0)
-            printf("End of file returned.\n");
-        else if (result > 0)
-            printf("%d bytes read.\n", result);
-        
-        bytesToDisplay = MIN(result, MAX_DATA_DISPLAY);
-        for (i = 0; i < bytesToDisplay; i++){
-            snprintf(temp, sizeof(temp), "%.8x ", (unsigned)buffer[i]);
-            strncpy(&hexBuffer[i*3], &temp[6], 3);
+    struct sweepReader *reader = arg;
+    char buffer[65536];
+    long long received = 0;
+    ssize_t result = 0, have;
+    
+    /*  The socket is this thread's alone until it is closed, so it can simply block.  */
+    (void) fcntl(reader->fd, F_SETFL, fcntl(reader->fd, F_GETFL) & ~O_NONBLOCK);
+    while (received < reader->bytes){
+        result = read(reader->fd, buffer, MIN((long long) sizeof(buffer), reader->bytes - received));
+        if (result <= 0)
+            break;
+        received += result;
+    }
+    pthread_mutex_lock(&reader->lock);
+    reader->received = received;
+    reader->drained = TRUE;
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->lock);
+    
+    while (result > 0){
+        for (have = 0; have < SWEEP_MESSAGE_SIZE; have += result){
+            result = read(reader->fd, buffer + have, SWEEP_MESSAGE_SIZE - have);
+            if (result <= 0)
+                break;
         }
-        hexBuffer[i*3] = '\0';
-        printf("First %d bytes received are: %s\n", bytesToDisplay, hexBuffer);
+        if (result <= 0 || write(reader->fd, buffer, SWEEP_MESSAGE_SIZE) != SWEEP_MESSAGE_SIZE)
+            break;
     }
+    return NULL;
 }
 
 
-/*
- *  Implement write command.
- *
- *  write 
- *
- *  ??  This is a first cut.  Such nicities as allowing the user to control what is written 
- *  ??  and providing options is left for another day.
- *
- */
-static void doWrite()
+/*  Run a socket command, returning the new socket's slot, or -1 if it failed.  */
+static int runSocketCommand(const char *domain, const char *type)
 {
-    int i, result,done;
-    char buffer[BUFFER_SIZE];
+    int before = gCurrent, beforeFd = gSockets[gCurrent].fd;
     
-    /*  Fill the buffer.  */
-    for (i = 0; i < BUFFER_SIZE; i++)
-        buffer[i] = '*';
+    runCommandLine("socket -d %s -t %s", domain, type);
+    if (gSockets[gCurrent].fd == UNUSED_FD || (gCurrent == before && gSockets[gCurrent].fd == beforeFd))
+        return -1;
+    return gCurrent;
+}
+
+
+/*  Set up the gCurrent socket with the values of a sweep point.  */
+static void applySweepPoint(const struct sweepOption options[], int count, const int at[])
+{
+    int i;
     
-    /*  Call the API.  */
-    do {
-        preAPISetup(WRITE_READY);   
-        if (gInterrupted)
-            return;
-        result = write(gSockfd[gCurrent], buffer, BUFFER_SIZE); 
-        done = postAPISetup(result);
-    } while (!done);
-    if (result < 0){
-        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
-        return;
-    } else if (result == 0 && gVerbose)
-        printf("Zero count returned.\n");
-    else if (result > 0 && gVerbose)
-        printf("%d bytes written.\n", result);
+    for (i = 0; i < count; i++)
+        runCommandLine("setsockopt %s %s", options[i].option->name, options[i].values[at[i]]);
 }
 
 
-/*
- *  Implement setsockopt command.
- *
- *  setsockopt level opt [-i value] 
- *
- */
-static void doSetsockopt()
+static void doSweep()
 {
-    int result, level, opt, intArg;
+    struct sweepOption options[MAX_SWEEP_OPTIONS];
+    struct sweepReader reader;
+    struct addrinfo hints, *addrInfo = NULL;
+    struct histogram roundTrips;
+    struct timespec deadline;
+    union optionValue value;
+    socklen_t length;
+    long long bytes, chunk = IOBUFFER_SIZE, roundTripCount = 10, sent, start, elapsed;
+    double rate, bestRate = -1;
+    int i, port, optionCount = 0, retval = 0, result, listener, client, server, ok, more;
+    int at[MAX_SWEEP_OPTIONS];
+    int saveCurrent = gCurrent;
+    enum command_enum saveCommand = gCommand;
+    char option, *host = "127.0.0.1", *next, *buffer = NULL, *domain;
+    char label[MAX_COMMAND_LINE], best[MAX_COMMAND_LINE] = "";
     
     /*  Process command line arguments      */
-    if (gTokenCount != 5){
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_SETSOCKOPT]);
+    gOptind = 0;
+    while (retval == 0 && (option = getOption(gTokenCount, gTokens, "s:r:a:")) != -1){
+        switch (option){
+            case 's':
+                retval = setSizeArgument(gOptarg, &chunk);
+                break;
+            case 'r':
+                retval = setSizeArgument(gOptarg, &roundTripCount);
+                break;
+            case 'a':
+                host = gOptarg;
+                break;
+            default:
+                retval = 1;
+                break;
+        }
+    }
+    if (retval || gOptind > gTokenCount - 4 || (gTokenCount - gOptind) % 2 != 0 || 
+            gTokenCount - gOptind - 2 > 2 * MAX_SWEEP_OPTIONS ||
+            setIntegerArgument(gTokens[gOptind], &port) != 0 || setSizeArgument(gTokens[gOptind + 1], &bytes) != 0 ||
+            bytes <= 0 || chunk <= 0 || chunk > INT_MAX || roundTripCount < 0){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_SWEEP].usage);
         return;
     }
     
-    result = setIntegerArgument(gTokens[1], &level);
-    if (result != 0){
-        fprintf(stderr, "Invalid level value.\n");
-            return;
+    /*  The grid.  The commands run below reuse gTokens, so what's needed is copied.  */
+    memset(options, 0, sizeof(options));
+    for (i = gOptind + 2; i < gTokenCount && retval == 0; i += 2){
+        options[optionCount].option = findSocketOption(gTokens[i]);
+        options[optionCount].text = strdup(gTokens[i + 1]);
+        optionCount++;
+        if (options[optionCount - 1].option == NULL){
+            fprintf(stderr, "Unknown socket option %s.\n", gTokens[i]);
+            retval = 1;
+            break;
+        }
+        if (options[optionCount - 1].text == NULL){
+            fprintf(stderr, "Unable to allocate sweep values.\n");
+            retval = 1;
+            break;
+        }
+        for (next = options[optionCount - 1].text; next != NULL && retval == 0; options[optionCount - 1].count++){
+            if (options[optionCount - 1].count == MAX_SWEEP_VALUES){
+                fprintf(stderr, "At most %d values for each option.\n", MAX_SWEEP_VALUES);
+                retval = 1;
+                break;
+            }
+            options[optionCount - 1].values[options[optionCount - 1].count] = strsep(&next, "/");
+            retval = parseOptionValue(options[optionCount - 1].option, 
+                            options[optionCount - 1].values[options[optionCount - 1].count], &value, &length);
+        }
     }
-        
-    result = setIntegerArgument(gTokens[2], &opt);
-    if (result != 0){
-        fprintf(stderr, "Invalid opt value.\n");
-            return;
+    host = strdup(host);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (retval == 0 && (host == NULL || (result = getaddrinfo(host, NULL, &hints, &addrInfo)) != 0)){
+        fprintf(stderr, "Error - %s is not a valid address.\n", host ? host : "");
+        retval = 1;
     }
-        
-    result = setIntegerArgument(gTokens[4], &intArg);
-    if (result != 0){
-        fprintf(stderr, "Invalid argument value.\n");
-            return;
+    if (retval)
+        goto done;
+    domain = addrInfo->ai_family == AF_INET ? "inet" : "inet6";
+    freeaddrinfo(addrInfo);
+    buffer = malloc(MAX(chunk, SWEEP_MESSAGE_SIZE));
+    if (buffer == NULL){
+        fprintf(stderr, "Unable to allocate %lld byte buffer.\n", chunk);
+        goto done;
     }
+    memset(buffer, '*', MAX(chunk, SWEEP_MESSAGE_SIZE));
+    
+    /*  Run each point of the grid, the last option varying fastest.  */
+    printf("%-48s %10s %10s %10s %10s\n", "configuration", "MB/s", "rtt p50", "rtt p99", "rtt max");
+    memset(at, 0, sizeof(at));
+    for (more = TRUE; more && !gInterrupted; ){
+        label[0] = 0;
+        for (i = 0; i < optionCount; i++)
+            snprintf(label + strlen(label), sizeof(label) - strlen(label), "%s%s=%s", i ? " " : "", 
+                        options[i].option->name, options[i].values[at[i]]);
         
-    /*  Call the API.  */
-    result = setsockopt(gSockfd[gCurrent], level, opt, &intArg, sizeof(int));   
-    if (result < 0){
-        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
-        return;
-    } 
+        /*  A fresh connection, with the options set on both ends before connecting.  */
+        gBulk = TRUE;
+        listener = client = server = -1;
+        listener = runSocketCommand(domain, "stream");
+        if (listener >= 0){
+            runCommandLine("setsockopt so_reuseaddr on");
+            applySweepPoint(options, optionCount, at);
+            runCommandLine("bind %d %s", port, host);
+            runCommandLine("listen 1");
+            client = runSocketCommand(domain, "stream");
+            if (client >= 0){
+                applySweepPoint(options, optionCount, at);
+                runCommandLine("connect %d %s", port, host);
+                runCommandLine("use %d", listener);
+                runCommandLine("accept");
+                if (gCurrent != listener)
+                    server = gCurrent;
+            }
+        }
+        
+        /*  Send the data, then time the round trips.  */
+        ok = FALSE;
+        histReset(&roundTrips);
+        if (server >= 0){
+            memset(&reader, 0, sizeof(reader));
+            reader.fd = gSockets[server].fd;
+            reader.bytes = bytes;
+            pthread_mutex_init(&reader.lock, NULL);
+            pthread_cond_init(&reader.changed, NULL);
+            result = pthread_create(&reader.thread, NULL, sweepReaderThread, &reader);
+            if (result != 0)
+                fprintf(stderr, "Unable to start reader - %s.\n", strerror(result));
+            else {
+                start = nowNs();
+                for (sent = 0, ok = TRUE; ok && sent < bytes; sent += MIN(chunk, bytes - sent))
+                    ok = transferAll(client, buffer, MIN(chunk, bytes - sent), TRUE);
+                
+                /*  The data has only arrived once the reader has it.  Wake each tick to see an interrupt.  */
+                pthread_mutex_lock(&reader.lock);
+                while (ok && !reader.drained && !gInterrupted){
+                    clock_gettime(CLOCK_REALTIME, &deadline);
+                    deadline.tv_sec += (deadline.tv_nsec + gTickNs) / 1000000000LL;
+                    deadline.tv_nsec = (deadline.tv_nsec + gTickNs) % 1000000000LL;
+                    (void) pthread_cond_timedwait(&reader.changed, &reader.lock, &deadline);
+                }
+                ok = ok && reader.drained && reader.received == bytes;
+                pthread_mutex_unlock(&reader.lock);
+                elapsed = nowNs() - start;
+                for (i = 0; ok && i < roundTripCount; i++){
+                    start = nowNs();
+                    ok = transferAll(client, buffer, SWEEP_MESSAGE_SIZE, TRUE) &&
+                            transferAll(client, buffer, SWEEP_MESSAGE_SIZE, FALSE);
+                    histRecord(&roundTrips, nowNs() - start);
+                }
+                shutdown(gSockets[client].fd, SHUT_RDWR);
+                pthread_join(reader.thread, NULL);
+            }
+            pthread_mutex_destroy(&reader.lock);
+            pthread_cond_destroy(&reader.changed);
+        }
+        
+        /*  Show how it did.  */
+        if (ok){
+            rate = bytes / (elapsed / 1e9) / 1e6;
+            printf("%-48s %10.2f %10lld %10lld %10lld\n", label, rate, histPercentile(&roundTrips, 50.0),
+                        histPercentile(&roundTrips, 99.0), roundTrips.max);
+            if (rate > bestRate){
+                bestRate = rate;
+                strcpy(best, label);
+            }
+        } else
+            printf("%-48s %10s\n", label, "failed");
+        fflush(stdout);
+        
+        /*  Tear the connection down, keeping an interrupt to stop the sweep.  */
+        ok = gInterrupted;
+        for (i = 0; i < 3; i++){
+            result = i == 0 ? server : i == 1 ? client : listener;
+            if (result >= 0 && gSockets[result].fd != UNUSED_FD){
+                runCommandLine("use %d", result);
+                runCommandLine("close");
+            }
+        }
+        gInterrupted = ok;
+        gBulk = FALSE;
+        
+        /*  On to the next point.  */
+        for (i = optionCount - 1; i >= 0 && ++at[i] == options[i].count; i--)
+            at[i] = 0;
+        more = i >= 0;
+    }
+    if (bestRate >= 0)
+        printf("Fastest:  %s at %.2f MB/s.\n", best, bestRate);
+    
+done:
+    for (i = 0; i < optionCount; i++)
+        free(options[i].text);
+    free(host);
+    free(buffer);
+    if (saveCurrent < gSocketSlots && gSockets[saveCurrent].fd != UNUSED_FD)
+        gCurrent = saveCurrent;
+    gCommand = saveCommand;
+    gApiTimed = FALSE;
 }
 
 
 /*
- *  Implement getsockopt command.
- *
- *  getsockopt level opt [-i] 
- *
+ *  Join or leave a multicast group on an interface, for any source or, with a source 
+ *  address, just that source (MCAST_JOIN_SOURCE_GROUP).  Returns the setsockopt() result.
  */
-static void doGetsockopt()
+static int setMembership(int fd, int interface, const struct sockaddr *group, const struct sockaddr *source, 
+                            int join)
+{
+    struct ipv6_mreq mcSpec;
+    struct ip_mreqn mcSpec4;
+    struct group_source_req sourceSpec;
+    int level = group->sa_family == AF_INET ? SOL_IP : SOL_IPV6;
+    socklen_t length = group->sa_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+    
+    if (source != NULL){
+        memset(&sourceSpec, 0, sizeof(sourceSpec));
+        sourceSpec.gsr_interface = interface;
+        memcpy(&sourceSpec.gsr_group, group, length);
+        memcpy(&sourceSpec.gsr_source, source, length);
+        return setsockopt(fd, level, join ? MCAST_JOIN_SOURCE_GROUP : MCAST_LEAVE_SOURCE_GROUP, 
+                            &sourceSpec, sizeof(sourceSpec));
+    }
+    if (group->sa_family == AF_INET){
+        memset(&mcSpec4, 0, sizeof(mcSpec4));
+        mcSpec4.imr_multiaddr = ((const struct sockaddr_in *) group)->sin_addr;
+        mcSpec4.imr_ifindex = interface;
+        return setsockopt(fd, level, join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP, &mcSpec4, sizeof(mcSpec4)); 
+    }
+    mcSpec.ipv6mr_interface = interface;
+    mcSpec.ipv6mr_multiaddr = ((const struct sockaddr_in6 *) group)->sin6_addr;
+    return setsockopt(fd, level, join ? IPV6_ADD_MEMBERSHIP : IPV6_DROP_MEMBERSHIP, &mcSpec, sizeof(mcSpec)); 
+}
+
+
+/*  Join or leave the group given as gTokens[2], from gTokens[3] if given, on the interface in gTokens[1].  */
+static void changeMembership(enum command_enum cmd, int join)
 {
-    int result, level, opt, optlen, intArg;
+    struct addrinfo *addrInfo, *sourceInfo = NULL;
+    struct addrinfo hints = {0, 0, 0, 0, 0, NULL, NULL, NULL};
+    int result, interface;
     
     /*  Process command line arguments      */
-    if (gTokenCount != 4){
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_GETSOCKOPT]);
+    if (gTokenCount != 3 && gTokenCount != 4){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[cmd].usage);
         return;
     }
     
-    result = setIntegerArgument(gTokens[1], &level);
+    result = setIntegerArgument(gTokens[1], &interface);
     if (result != 0){
-        fprintf(stderr, "Invalid level value.\n");
+        fprintf(stderr, "Invalid interfaceIndex value.\n");
             return;
     }
         
-    result = setIntegerArgument(gTokens[2], &opt);
-    if (result != 0){
-        fprintf(stderr, "Invalid opt value.\n");
-            return;
+    hints.ai_family = gSockets[gCurrent].domain;
+    hints.ai_socktype = gSockets[gCurrent].type;
+    hints.ai_protocol = gSockets[gCurrent].protocol;
+    result = getaddrinfo(gTokens[2], NULL, &hints, &addrInfo);
+    if (result){
+        fprintf(stderr, "Error - %s is not a valid address:  %s.\n", gTokens[2], gai_strerror(result));
+        return;
+    }
+    if (gTokenCount == 4 && (result = getaddrinfo(gTokens[3], NULL, &hints, &sourceInfo)) != 0){
+        fprintf(stderr, "Error - %s is not a valid address:  %s.\n", gTokens[3], gai_strerror(result));
+        freeaddrinfo(addrInfo);
+        return;
     }
     
-    optlen = sizeof(int);
-        
     /*  Call the API.  */
-    result = getsockopt(gSockfd[gCurrent], level, opt, &intArg, &optlen);   
+    result = setMembership(gSockets[gCurrent].fd, interface, addrInfo->ai_addr, 
+                                sourceInfo ? sourceInfo->ai_addr : NULL, join);
+    freeaddrinfo(addrInfo);
+    if (sourceInfo != NULL)
+        freeaddrinfo(sourceInfo);
     if (result < 0){
         fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
         return;
     } 
-    
-    printf("Option value = %d, option length = %d.\n", intArg, optlen);
 }
 
 
 /*
  *  Implement multijoin command.
  *
- *  multijoin interfaceIndex hostaddress 
+ *  multijoin interfaceIndex hostaddress [sourceaddress]
+ *
+ *  Joins an IPv4 or IPv6 group, as fits the socket's domain.  With a source address, 
+ *  only that source's traffic to the group is received (source-specific multicast).
  *
  */
 static void doMultijoin()
 {
-    struct ipv6_mreq mcSpec;
-    struct addrinfo *addrInfo;
-    struct addrinfo hints = {0, 0, 0, 0, 0, NULL, NULL, NULL};
-    int result;
+    changeMembership(CMD_MULTIJOIN, TRUE);
+}
+
+
+/*
+ *  Implement multileave command.
+ *
+ *  multileave interfaceIndex hostaddress [sourceaddress]
+ *
+ */
+static void doMultileave()
+{
+    changeMembership(CMD_MULTILEAVE, FALSE);
+}
+
+
+/*
+ *  Implement multicast command.
+ *
+ *  multicast group port count [-i interfaceIndex] [-s size] [-r rate] [-b rcvbuf]
+ *
+ *  Sends count datagrams of size (default 64) bytes to the IPv4 or IPv6 group, at rate 
+ *  packets/s or as fast as possible, through interfaceIndex (default the loopback) with
+ *  multicast loop on.  A thread receives them on a socket that has joined the group, 
+ *  using the socket, setsockopt, bind and multijoin commands.  Each datagram carries a
+ *  sequence number and the time it was sent, so the receiver counts packets lost (and 
+ *  the gaps they fell in), reordered and duplicated, and the one-way latency.  Sends
+ *  refused with ENOBUFS or EAGAIN are counted as dropped by the sender, not as lost.
+ *
+ */
+#define MULTICAST_IDLE_NS  100000000LL       /*  Quiet time after the last send that ends receiving  */
+
+struct multicastHeader {
+    unsigned long long sequence;
+    long long sentNs;
+};
+
+struct multicastReceiver {
+    pthread_t thread;
+    int fd;
+    int size;
+    long long count;                         /*  Datagrams being sent  */
+    unsigned char *seen;                     /*  Bit per sequence number  */
+    long long received, bytes, lost, gaps, reordered, duplicates, next;
+    long long firstNs, lastNs;
+    struct histogram latency;                /*  One way  */
+    int sendDone;
+};
+
+
+/*  Receive until everything has arrived, or the sender is done and it's quiet.  */
+static void *multicastReceiverThread(void *arg)
+{
+    struct multicastReceiver *receiver = arg;
+    struct multicastHeader header;
+    struct pollfd pfd;
+    char *buffer;
+    long long now, idleSince = 0;
+    unsigned long long sequence;
+    ssize_t result;
+    
+    buffer = malloc(receiver->size);
+    if (buffer == NULL)
+        return NULL;
+    pfd.fd = receiver->fd;
+    pfd.events = POLLIN;
+    while (receiver->received < receiver->count && !gInterrupted){
+        result = recv(receiver->fd, buffer, receiver->size, MSG_DONTWAIT);
+        if (result < 0){
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                break;
+            
+            /*  Nothing waiting.  Give up once the sender has been done a while.  */
+            now = nowNs();
+            if (!__atomic_load_n(&receiver->sendDone, __ATOMIC_ACQUIRE))
+                idleSince = 0;
+            else if (idleSince == 0)
+                idleSince = now;
+            else if (now - idleSince > MULTICAST_IDLE_NS)
+                break;
+            (void) poll(&pfd, 1, 10);
+            continue;
+        }
+        now = nowNs();
+        idleSince = 0;
+        if (result < (ssize_t) sizeof(header))
+            continue;
+        memcpy(&header, buffer, sizeof(header));
+        sequence = header.sequence;
+        if (sequence >= (unsigned long long) receiver->count)
+            continue;
+        
+        /*  Account for it.  */
+        if (receiver->seen[sequence / 8] & (1 << (sequence % 8))){
+            receiver->duplicates++;
+            continue;
+        }
+        receiver->seen[sequence / 8] |= 1 << (sequence % 8);
+        if (receiver->received++ == 0)
+            receiver->firstNs = now;
+        receiver->lastNs = now;
+        receiver->bytes += result;
+        histRecord(&receiver->latency, now - header.sentNs);
+        if ((long long) sequence < receiver->next)
+            receiver->reordered++;
+        else {
+            if ((long long) sequence > receiver->next)
+                receiver->gaps++;
+            receiver->next = sequence + 1;
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+
+static void doMulticast()
+{
+    struct multicastReceiver receiver;
+    struct multicastHeader header;
+    struct addrinfo hints, *addrInfo = NULL;
+    struct sockaddr_storage group;
+    struct ip_mreqn interface4;
+    struct timespec pause;
+    long long count, size = 64, rate = 0, rcvbuf = 0, sent = 0, dropped = 0, tries, start, elapsed, next, wait;
+    int port, interface, retval = 0, result, sender = -1, listener = -1, saveCurrent = gCurrent;
+    enum command_enum saveCommand = gCommand;
+    char option, *groupName, *buffer = NULL, *domain;
     
     /*  Process command line arguments      */
-    if (gTokenCount != 3){
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_MULTIJOIN]);
+    interface = if_nametoindex("lo");
+    gOptind = 0;
+    while (retval == 0 && (option = getOption(gTokenCount, gTokens, "i:s:r:b:")) != -1){
+        switch (option){
+            case 'i':
+                retval = setIntegerArgument(gOptarg, &interface);
+                break;
+            case 's':
+                retval = setSizeArgument(gOptarg, &size);
+                break;
+            case 'r':
+                retval = setSizeArgument(gOptarg, &rate);
+                break;
+            case 'b':
+                retval = setSizeArgument(gOptarg, &rcvbuf);
+                break;
+            default:
+                retval = 1;
+                break;
+        }
+    }
+    if (retval || gOptind != gTokenCount - 3 || setIntegerArgument(gTokens[gOptind + 1], &port) != 0 ||
+            setSizeArgument(gTokens[gOptind + 2], &count) != 0 || count < 1 || rate < 0 || rcvbuf < 0 ||
+            size < (long long) sizeof(header) || size > 65507){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_MULTICAST].usage);
         return;
     }
     
-    result = setIntegerArgument(gTokens[1], &mcSpec.ipv6mr_interface);
-    if (result != 0){
-        fprintf(stderr, "Invalid interfaceIndex value.\n");
-            return;
-    }
-        
-    hints.ai_family = gDomain;
-    hints.ai_socktype = gType;
-    hints.ai_protocol = gProtocol;
-    result = getaddrinfo(gTokens[2], NULL, &hints, &addrInfo);
-    if (result){
-        fprintf(stderr, "Error - %s is not a valid address:  %s.\n", gTokens[2], gai_strerror(result));
+    /*  Where to send.  The commands run below reuse gTokens, so the group is copied.  */
+    groupName = strdup(gTokens[gOptind]);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_DGRAM;
+    if (groupName == NULL || (result = getaddrinfo(groupName, NULL, &hints, &addrInfo)) != 0){
+        fprintf(stderr, "Error - %s is not a valid address.\n", gTokens[gOptind]);
+        free(groupName);
         return;
     }
-    memcpy(&mcSpec.ipv6mr_multiaddr, &((struct sockaddr_in6 *)(addrInfo->ai_addr))->sin6_addr, sizeof(struct in6_addr));
+    memset(&group, 0, sizeof(group));
+    memcpy(&group, addrInfo->ai_addr, addrInfo->ai_addrlen);
+    if (group.ss_family == AF_INET){
+        ((struct sockaddr_in *) &group)->sin_port = htons(port);
+        domain = "inet";
+    } else {
+        ((struct sockaddr_in6 *) &group)->sin6_port = htons(port);
+        ((struct sockaddr_in6 *) &group)->sin6_scope_id = interface;
+        domain = "inet6";
+    }
+    freeaddrinfo(addrInfo);
     
-    /*  Call the API.  */
-    result = setsockopt(gSockfd[gCurrent], SOL_IPV6, IPV6_ADD_MEMBERSHIP, &mcSpec, sizeof(mcSpec)); 
+    memset(&receiver, 0, sizeof(receiver));
+    receiver.size = size;
+    receiver.count = count;
+    receiver.seen = calloc((count + 7) / 8, 1);
+    buffer = calloc(size, 1);
+    if (receiver.seen == NULL || buffer == NULL){
+        fprintf(stderr, "Unable to allocate %lld packets.\n", count);
+        goto done;
+    }
+    
+    /*  The receiving socket, on the group.  */
+    gBulk = TRUE;
+    listener = runSocketCommand(domain, "datagram");
+    if (listener < 0)
+        goto done;
+    runCommandLine("setsockopt so_reuseaddr on");
+    if (rcvbuf != 0)
+        runCommandLine("setsockopt so_rcvbuf %lld", rcvbuf);
+    runCommandLine("bind %d %s", port, group.ss_family == AF_INET ? "0.0.0.0" : "::");
+    runCommandLine("multijoin %d %s", interface, groupName);
+    
+    /*  The sending socket, going out the interface and looping back.  */
+    sender = runSocketCommand(domain, "datagram");
+    if (sender < 0)
+        goto done;
+    if (group.ss_family == AF_INET){
+        memset(&interface4, 0, sizeof(interface4));
+        interface4.imr_ifindex = interface;
+        result = setsockopt(gSockets[sender].fd, IPPROTO_IP, IP_MULTICAST_IF, &interface4, sizeof(interface4));
+        runCommandLine("setsockopt ip_multicast_loop on");
+    } else {
+        result = setsockopt(gSockets[sender].fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &interface, sizeof(interface));
+        runCommandLine("setsockopt ipv6_multicast_loop on");
+    }
     if (result < 0){
-        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
-        return;
-    } 
+        fprintf(stderr, "Error setting the multicast interface - %s.\n", strerror(errno));
+        goto done;
+    }
+    
+    receiver.fd = gSockets[listener].fd;
+    result = pthread_create(&receiver.thread, NULL, multicastReceiverThread, &receiver);
+    if (result != 0){
+        fprintf(stderr, "Unable to start receiver - %s.\n", strerror(result));
+        goto done;
+    }
+    
+    /*  
+     *  Send, pacing to the rate if there is one.  Sequence numbers only go to datagrams
+     *  that were sent, so drops at the sender don't show as gaps at the receiver.
+     */
+    start = next = nowNs();
+    for (tries = 0; tries < count && !gInterrupted; tries++){
+        if (rate != 0){
+            next = start + tries * 1000000000LL / rate;
+            wait = next - nowNs();
+            if (wait > 50000){
+                pause.tv_sec = wait / 1000000000;
+                pause.tv_nsec = wait % 1000000000;
+                nanosleep(&pause, NULL);
+            }
+            while (nowNs() < next)
+                ;
+        }
+        header.sequence = sent;
+        header.sentNs = nowNs();
+        memcpy(buffer, &header, sizeof(header));
+        if (sendto(gSockets[sender].fd, buffer, size, 0, (struct sockaddr *) &group, sizeof(group)) < 0){
+            if (errno == ENOBUFS || errno == EAGAIN){
+                dropped++;
+                continue;
+            }
+            fprintf(stderr, "Error sending - %s.\n", strerror(errno));
+            break;
+        }
+        gSockets[sender].bytesOut += size;
+        sent++;
+    }
+    elapsed = nowNs() - start;
+    gSockets[sender].apiCalls += tries;
+    __atomic_store_n(&receiver.sendDone, TRUE, __ATOMIC_RELEASE);
+    pthread_join(receiver.thread, NULL);
+    gSockets[listener].bytesIn += receiver.bytes;
+    
+    /*  Report.  Only packets that were sent can be lost, and a loss at the end is a gap too.  */
+    receiver.lost = sent - receiver.received;
+    if (receiver.next < sent)
+        receiver.gaps++;
+    printf("Sent %lld packets of %lld bytes in %.3f s:  %.0f packets/s, %lld dropped by the sender.\n", sent, 
+                size, elapsed / 1e9, sent / (MAX(elapsed, 1) / 1e9), dropped);
+    printf("Received %lld in %.3f s:  %.0f packets/s.\n", receiver.received, 
+                (receiver.lastNs - receiver.firstNs) / 1e9, 
+                receiver.received / (MAX(receiver.lastNs - receiver.firstNs, 1) / 1e9));
+    printf("Lost %lld (%.3f%%) in %lld gaps, %lld reordered, %lld duplicates.\n", receiver.lost, 
+                sent ? 100.0 * receiver.lost / sent : 0.0, receiver.gaps, receiver.reordered, receiver.duplicates);
+    if (receiver.received != 0){
+        histPrintHeader("");
+        histPrintLine("one-way latency ns", &receiver.latency);
+    }
+    
+done:
+    if (sender >= 0){
+        runCommandLine("use %d", sender);
+        runCommandLine("close");
+    }
+    if (listener >= 0){
+        runCommandLine("use %d", listener);
+        runCommandLine("close");
+    }
+    gBulk = FALSE;
+    free(receiver.seen);
+    free(buffer);
+    free(groupName);
+    if (saveCurrent < gSocketSlots && gSockets[saveCurrent].fd != UNUSED_FD)
+        gCurrent = saveCurrent;
+    gCommand = saveCommand;
+    gApiTimed = FALSE;
 }
 
 
 /*
- *  Implement multileave command.
+ *  Implement multiscale command.
+ *
+ *  multiscale port groups [-k sockets] [-n packets] [-i interfaceIndex] [-a sourceaddress] [-d inet | inet6]
  *
- *  multileave interfaceIndex hostaddress 
+ *  Measures how multicast membership scales.  For 1, 2, 4 ... groups, up to the number 
+ *  given, opens sockets (default 1) bound to the port, joins the groups spread over them
+ *  (from just the source, if given), sends packets (default 1000) round the groups 
+ *  through interfaceIndex (default the loopback), then leaves the groups again.  Shows 
+ *  the join and leave latencies, and the time from send to receive for each packet, at 
+ *  each group count.  IPv4 groups are 239.2.x.y and IPv6 groups ff02::2:x.
  *
  */
-static void doMultileave()
+#define MAX_SCALE_GROUPS   65535
+#define MAX_SCALE_SOCKETS  1024
+#define SCALE_WAIT_MS      100               /*  Give a packet up as lost after this  */
+
+
+/*  Make the address of the numbered group.  */
+static void scaleGroup(int family, int number, int port, int interface, struct sockaddr_storage *group)
 {
-    struct ipv6_mreq mcSpec;
-    struct addrinfo *addrInfo;
-    struct addrinfo hints = {0, 0, 0, 0, 0, NULL, NULL, NULL};
-    int result;
+    struct sockaddr_in *group4 = (struct sockaddr_in *) group;
+    struct sockaddr_in6 *group6 = (struct sockaddr_in6 *) group;
+    
+    memset(group, 0, sizeof(*group));
+    if (family == AF_INET){
+        group4->sin_family = AF_INET;
+        group4->sin_port = htons(port);
+        group4->sin_addr.s_addr = htonl(0xef020000 | (number + 1));
+    } else {
+        group6->sin6_family = AF_INET6;
+        group6->sin6_port = htons(port);
+        group6->sin6_scope_id = interface;
+        group6->sin6_addr.s6_addr[0] = 0xff;
+        group6->sin6_addr.s6_addr[1] = 0x02;
+        group6->sin6_addr.s6_addr[13] = 0x02;
+        group6->sin6_addr.s6_addr[14] = (number + 1) >> 8;
+        group6->sin6_addr.s6_addr[15] = (number + 1) & 0xff;
+    }
+}
+
+
+static void doMultiscale()
+{
+    struct addrinfo hints, *sourceInfo = NULL;
+    struct sockaddr_storage group;
+    struct sockaddr *source = NULL;
+    struct ip_mreqn interface4;
+    struct histogram joins, leaves, packets;
+    struct pollfd pfd;
+    char buffer[64], received[64], *domain = "inet", *sourceName = NULL, option;
+    long long maxGroups, socketCount = 1, packetCount = 1000, start, p, lost, wait;
+    unsigned long long sequence, sequenceBase = 0;
+    int groups, joined, g, i, port, interface, family, retval = 0, result, sender = -1, saveCurrent = gCurrent;
+    int slots[MAX_SCALE_SOCKETS], limit;
+    enum command_enum saveCommand = gCommand;
     
     /*  Process command line arguments      */
-    if (gTokenCount != 3){
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_MULTIJOIN]);
+    memset(buffer, '*', sizeof(buffer));
+    interface = if_nametoindex("lo");
+    gOptind = 0;
+    while (retval == 0 && (option = getOption(gTokenCount, gTokens, "k:n:i:a:d:")) != -1){
+        switch (option){
+            case 'k':
+                retval = setSizeArgument(gOptarg, &socketCount);
+                break;
+            case 'n':
+                retval = setSizeArgument(gOptarg, &packetCount);
+                break;
+            case 'i':
+                retval = setIntegerArgument(gOptarg, &interface);
+                break;
+            case 'a':
+                sourceName = gOptarg;
+                break;
+            case 'd':
+                domain = gOptarg;
+                retval = strcasecmp(domain, "inet") != 0 && strcasecmp(domain, "inet6") != 0;
+                break;
+            default:
+                retval = 1;
+                break;
+        }
+    }
+    if (retval || gOptind != gTokenCount - 2 || setIntegerArgument(gTokens[gOptind], &port) != 0 ||
+            setSizeArgument(gTokens[gOptind + 1], &maxGroups) != 0 || maxGroups < 1 || maxGroups > MAX_SCALE_GROUPS ||
+            socketCount < 1 || socketCount > MIN(maxGroups, MAX_SCALE_SOCKETS) || packetCount < 0){
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_MULTISCALE].usage);
         return;
     }
+    family = strcasecmp(domain, "inet") == 0 ? AF_INET : AF_INET6;
+    domain = family == AF_INET ? "inet" : "inet6";
+    
+    /*  The source, for source-specific joins.  The commands run below reuse gTokens, so it's copied.  */
+    if (sourceName != NULL){
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = family;
+        hints.ai_socktype = SOCK_DGRAM;
+        sourceName = strdup(sourceName);
+        if (sourceName == NULL || (result = getaddrinfo(sourceName, NULL, &hints, &sourceInfo)) != 0){
+            fprintf(stderr, "Error - %s is not a valid %s source address.\n", sourceName ? sourceName : "", domain);
+            free(sourceName);
+            return;
+        }
+        source = sourceInfo->ai_addr;
+    }
+    
+    /*  IPv4 limits how many groups a socket may join.  */
+    if (family == AF_INET && readSysctl("/proc/sys/net/ipv4/igmp_max_memberships", &limit, 1) == 0 &&
+            (maxGroups + socketCount - 1) / socketCount > limit)
+        printf("net.ipv4.igmp_max_memberships is %d, so joins past %lld groups will fail.  "
+                    "Use more sockets (-k) or raise it.\n", limit, limit * socketCount);
+    
+    /*  The sender, going out the interface and looping back, from the source if there is one.  */
+    gBulk = TRUE;
+    sender = runSocketCommand(domain, "datagram");
+    if (sender < 0)
+        goto done;
+    if (sourceName != NULL)
+        runCommandLine("bind 0 %s", sourceName);
+    if (family == AF_INET){
+        memset(&interface4, 0, sizeof(interface4));
+        interface4.imr_ifindex = interface;
+        result = setsockopt(gSockets[sender].fd, IPPROTO_IP, IP_MULTICAST_IF, &interface4, sizeof(interface4));
+        runCommandLine("setsockopt ip_multicast_loop on");
+    } else {
+        result = setsockopt(gSockets[sender].fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &interface, sizeof(interface));
+        runCommandLine("setsockopt ipv6_multicast_loop on");
+    }
+    if (result < 0){
+        fprintf(stderr, "Error setting the multicast interface - %s.\n", strerror(errno));
+        goto done;
+    }
+    
+    printf("%7s %7s %10s %10s %10s %10s %10s %10s %8s\n", "groups", "sockets", "join p50", "join p99", 
+                "leave p50", "leave p99", "packet p50", "packet p99", "lost");
+    for (groups = 1; !gInterrupted; groups = MIN(2 * groups, maxGroups)){
+        histReset(&joins);
+        histReset(&leaves);
+        histReset(&packets);
+        
+        /*  The receiving sockets.  */
+        for (i = 0; i < MIN(socketCount, groups); i++){
+            slots[i] = runSocketCommand(domain, "datagram");
+            if (slots[i] < 0)
+                break;
+            runCommandLine("setsockopt so_reuseaddr on");
+            
+            /*  Only take packets for the socket's own groups, not every group joined on the port.  */
+            runCommandLine("setsockopt %s off", family == AF_INET ? "ip_multicast_all" : "ipv6_multicast_all");
+            runCommandLine("bind %d %s", port, family == AF_INET ? "0.0.0.0" : "::");
+        }
+        
+        /*  Join the groups, dealing them out to the sockets in turn.  */
+        for (joined = 0; i == MIN(socketCount, groups) && joined < groups; joined++){
+            scaleGroup(family, joined, port, interface, &group);
+            start = nowNs();
+            result = setMembership(gSockets[slots[joined % i]].fd, interface, (struct sockaddr *) &group, source, TRUE);
+            if (result < 0){
+                fprintf(stderr, "Joining group %d failed - %s.\n", joined + 1, strerror(errno));
+                break;
+            }
+            histRecord(&joins, nowNs() - start);
+        }
+        
+        /*  
+         *  Send round the groups, timing each packet until it is received.  Each carries its
+         *  sequence number, so a late packet given up as lost isn't taken for a later one.
+         */
+        for (p = 0, lost = 0; joined > 0 && p < packetCount && !gInterrupted; p++){
+            g = p % joined;
+            scaleGroup(family, g, port, interface, &group);
+            pfd.fd = gSockets[slots[g % i]].fd;
+            pfd.events = POLLIN;
+            sequence = sequenceBase + p;
+            memcpy(buffer, &sequence, sizeof(sequence));
+            start = nowNs();
+            if (sendto(gSockets[sender].fd, buffer, sizeof(buffer), 0, (struct sockaddr *) &group, sizeof(group)) < 0){
+                lost++;
+                continue;
+            }
+            do {
+                result = recv(pfd.fd, received, sizeof(received), MSG_DONTWAIT);
+                if (result < 0){
+                    wait = SCALE_WAIT_MS - (nowNs() - start) / 1000000;
+                    if (errno != EAGAIN || wait <= 0 || poll(&pfd, 1, wait) <= 0)
+                        break;
+                }
+            } while (result < (ssize_t) sizeof(sequence) || memcmp(received, &sequence, sizeof(sequence)) != 0);
+            if (result < 0)
+                lost++;
+            else
+                histRecord(&packets, nowNs() - start);
+        }
+        sequenceBase += packetCount;
+        
+        /*  Leave them again.  */
+        for (g = 0; g < joined; g++){
+            scaleGroup(family, g, port, interface, &group);
+            start = nowNs();
+            if (setMembership(gSockets[slots[g % i]].fd, interface, (struct sockaddr *) &group, source, FALSE) == 0)
+                histRecord(&leaves, nowNs() - start);
+        }
+        
+        printf("%7d %7d %10lld %10lld %10lld %10lld %10lld %10lld %8lld\n", joined, i, histPercentile(&joins, 50.0), 
+                    histPercentile(&joins, 99.0), histPercentile(&leaves, 50.0), histPercentile(&leaves, 99.0),
+                    histPercentile(&packets, 50.0), histPercentile(&packets, 99.0), lost);
+        fflush(stdout);
+        
+        /*  Close the receivers, keeping an interrupt to stop the test.  */
+        result = gInterrupted;
+        while (--i >= 0){
+            runCommandLine("use %d", slots[i]);
+            runCommandLine("close");
+        }
+        gInterrupted = result;
+        if (joined < groups || groups == maxGroups)
+            break;
+    }
     
-    result = setIntegerArgument(gTokens[1], &mcSpec.ipv6mr_interface);
-    if (result != 0){
-        fprintf(stderr, "Invalid interfaceIndex value.\n");
-            return;
-    }
-        
-    hints.ai_family = gDomain;
-    hints.ai_socktype = gType;
-    hints.ai_protocol = gProtocol;
-    result = getaddrinfo(gTokens[2], NULL, &hints, &addrInfo);
-    if (result){
-        fprintf(stderr, "Error - %s is not a valid address:  %s.\n", gTokens[2], gai_strerror(result));
-        return;
+done:
+    if (sender >= 0){
+        runCommandLine("use %d", sender);
+        runCommandLine("close");
     }
-    memcpy(&mcSpec.ipv6mr_multiaddr, &((struct sockaddr_in6 *)(addrInfo->ai_addr))->sin6_addr, sizeof(struct in6_addr));    
-    /*  Call the API.  */
-    result = setsockopt(gSockfd[gCurrent], SOL_IPV6, IPV6_DROP_MEMBERSHIP, &mcSpec, sizeof(mcSpec));    
-    if (result < 0){
-        fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
-        return;
-    } 
+    gBulk = FALSE;
+    if (sourceInfo != NULL)
+        freeaddrinfo(sourceInfo);
+    free(sourceName);
+    if (saveCurrent < gSocketSlots && gSockets[saveCurrent].fd != UNUSED_FD)
+        gCurrent = saveCurrent;
+    gCommand = saveCommand;
+    gApiTimed = FALSE;
 }
 
 
@@ -1327,21 +5491,23 @@ static void doMultileave()
 static void doShutdown()
 {
     int option, result;
-    static char *oStrings[] = {"shut_rd", "shut_wr", "shut_rdwr", NULL};
-    static int oValues[] = {SHUT_RD, SHUT_WR, SHUT_RDWR};
+    static const struct namedValue howValues[] = {
+        {"shut_rd", SHUT_RD}, {"shut_wr", SHUT_WR}, {"shut_rdwr", SHUT_RDWR}, {NULL}
+    };
+    static struct nameIndex howIndex;
             
     /*  Process command line arguments      */
     if (gTokenCount != 2){
-        fprintf(stderr, "gUsage:  %s.\n", gUsage[CMD_SHUTDOWN]);
+        fprintf(stderr, "gUsage:  %s.\n", gCommandTable[CMD_SHUTDOWN].usage);
         return;
     }
     
-    result = getNamedValue(gTokens[1], oStrings, oValues, &option);
+    result = getNamedValue(gTokens[1], howValues, &howIndex, &option);
     if (result != 0){
         fprintf(stderr, "Invalid shutdown option value.\n");
             return;
     }
-    result = shutdown(gSockfd[gCurrent], option);
+    result = shutdown(gSockets[gCurrent].fd, option);
     if (result < 0){
         fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
         return;
@@ -1361,7 +5527,7 @@ static void doGetsockname()
     struct sockaddr_in6 addr;
     socklen_t len = sizeof(addr);
     
-    result = getsockname(gSockfd[gCurrent], (struct sockaddr *)&addr, &len);
+    result = getsockname(gSockets[gCurrent].fd, (struct sockaddr *)&addr, &len);
     if (result < 0){
         fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
         return;
@@ -1386,7 +5552,7 @@ static void doGetpeername()
     struct sockaddr_in6 addr;
     socklen_t len = sizeof(addr);
     
-    result = getpeername(gSockfd[gCurrent], (struct sockaddr *)&addr, &len);
+    result = getpeername(gSockets[gCurrent].fd, (struct sockaddr *)&addr, &len);
     if (result < 0){
         fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
         return;
@@ -1409,25 +5575,93 @@ static void doClose()
 {
     int result;
     
-    result = close(gSockfd[gCurrent]);
+    epollForget(gCurrent);
+    uringForget(gSockets[gCurrent].fd);
+    result = close(gSockets[gCurrent].fd);
     if (result < 0){
         fprintf(stderr, "API returned %d.  Error %d passed in errno - %s.\n", result, errno, strerror(errno));
         return;
     }   
     
-    gSockfd[gCurrent] = UNUSED_FD;
+    releaseSocketSlot(gCurrent);
+}
+
+
+/*
+ *  Implement sockets command.
+ *
+ *  sockets
+ *
+ *  Lists the open sockets and what has been done with them.
+ */
+static void doSockets()
+{
+    int slot, open = 0;
+    struct socketInfo *info;
+    
+    printf("%6s %6s %6s %6s %6s %-12s %10s %8s %10s %14s %14s\n", "socket", "fd", "domain", "type", 
+                "proto", "model", "calls", "errors", "avg ns", "bytes in", "bytes out");
+    for (slot = 0; slot < gSocketSlots; slot++){
+        info = &gSockets[slot];
+        if (info->fd == UNUSED_FD)
+            continue;
+        open++;
+        printf("%6d %6d %6d %6d %6d %-12s %10ld %8ld %10lld %14lld %14lld\n", slot, info->fd, 
+                    info->domain, info->type, info->protocol, gModelNames[info->model], info->apiCalls, 
+                    info->apiErrors, info->apiCalls ? info->apiNs / info->apiCalls : 0, 
+                    info->bytesIn, info->bytesOut);
+    }
+    printf("%d sockets open, %d slots allocated.\n", open, gSocketSlots);
+}
+
+
+static FILE *gScript;                  /*  Script run in batch mode, or NULL when interactive  */
+static long gLineNumber;               /*  Lines read from the script  */
+
+/*
+ *  Input a (non-empty) command line, or return NULL at end of input.  The caller frees it.
+ *  Interactively, readline() is used with the given prompt.  In batch mode, lines are read
+ *  straight from the script without prompts or history, and lines starting with # are skipped.
+ */
+static char *getCommandLine(const char *prompt)
+{
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    
+    if (gScript == NULL){
+        while ((line = readline(prompt)) != NULL){
+            if (*line != 0){
+                add_history(line);
+                return line;
+            }
+            free(line);
+        }
+        return NULL;
+    }
+    
+    while ((length = getline(&line, &size, gScript)) >= 0){
+        gLineNumber++;
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            line[--length] = 0;
+        if (length > 0 && line[0] != '#')
+            return line;
+    }
+    free(line);
+    return NULL;
 }
 
 
 static void showgUsage()
 {
-    fprintf(stderr, "gUsage:  socktest [-v] \n");
+    fprintf(stderr, "gUsage:  socktest [-v] [-f script | -f -]\n");
 }
 
 
 /*  Signal handler for user interrupts.  */
 static void interruptSignalHandler(int sig)
 {
+    (void) sig;
     printf("User interrupt received.\n");
     gInterrupted = TRUE;
 }
@@ -1435,42 +5669,640 @@ static void interruptSignalHandler(int sig)
 
 static void pipeSignalHandler(int sig)
 {
+    (void) sig;
     printf("Broken pipe signal received.\n");
     gInterrupted = TRUE;
 }
 
 
-int main(int argc, char *argv[], char *envp[])
+/*
+ *  Break a command line into tokens, in-place.  Returns the count, or -1.  Case is kept, 
+ *  for paths and string values;  names and options are matched in any case.  Separators
+ *  are tokens even when written against a command, as in "help; sockets".
+ */
+static int tokenizeLine(char *line, char *tokens[])
+{
+    static char separators[] = ";\0{\0}";
+    int count = 0;
+    char *p, *separator;
+    
+    /*  Break the string into tokens.  Each token ends where the next delimiter is nulled.  */
+    for (p = line; *p != 0; ){
+        if (strchr(CMDDELIMS, *p) != NULL){
+            *p++ = 0;
+            continue;
+        }
+        if (count >= MAXTOKENS - 1){
+            fprintf(stderr, "Too many tokens in input line.\n");
+            return -1;
+        }
+        separator = strchr(CMDSEPARATORS, *p);
+        if (separator != NULL){
+            tokens[count++] = &separators[2 * (separator - CMDSEPARATORS)];
+            *p++ = 0;
+        } else {
+            tokens[count++] = p;
+            while (*p != 0 && strchr(CMDDELIMS, *p) == NULL && strchr(CMDSEPARATORS, *p) == NULL)
+                p++;
+        }
+    }
+    tokens[count] = NULL;
+    return count;
+}
+
+
+/*  Find a command by name, returning NUM_COMMANDS if there is none.  */
+static enum command_enum lookupCommand(const char *name)
+{
+    int i;
+    
+    i = lookupName(&gCommandIndex, &gCommandTable[0].name, sizeof(gCommandTable[0]), name);
+    return i < 0 ? NUM_COMMANDS : i;
+}
+
+
+/*  Implement quit:  the main loop sees gQuit and stops.  */
+static void doQuit()
+{
+    gQuit = TRUE;
+}
+
+
+/*  Handler for repeat and for when they turn up outside the start of a line.  */
+static void doBlockOnly()
+{
+    fprintf(stderr, "%s can only start a block.\n", gCommandTable[gCommand].name);
+}
+
+
+/*  Run the command whose tokens are in gTokens.  Returns TRUE if it was quit.  */
+static int dispatchCommand(enum command_enum cmd)
+{
+    long long commandStart;
+    
+    /*  Dispatch to the command processor.  An interrupt stops all the workers.  */
+    if (gWorker < 0)
+        gInterrupted = FALSE;
+    gCommand = cmd;
+    gApiTimed = FALSE;
+    commandStart = nowNs();
+    gCommandTable[cmd].handler();
+    
+    /*  
+     *  Typed commands that didn't time an API themselves are timed as a whole, apart from
+     *  the API latencies.  Commands run by other threads aren't.
+     */
+    if (!gApiTimed && cmd != CMD_STATS && gWorker < 0){
+        if (gCommandTimes[cmd] == NULL && (gCommandTimes[cmd] = malloc(sizeof(struct histogram))) != NULL)
+            histReset(gCommandTimes[cmd]);
+        if (gCommandTimes[cmd] != NULL)
+            histRecord(gCommandTimes[cmd], nowNs() - commandStart);
+    }
+    
+    return gQuit;
+}
+
+
+/*  Run a command given printf-style, as if it had been typed.  It can't start a block.  */
+static void runCommandLine(const char *format, ...)
+{
+    char line[MAX_COMMAND_LINE];
+    enum command_enum cmd;
+    va_list args;
+    
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    
+    gTokenCount = tokenizeLine(line, gTokens);
+    if (gTokenCount <= 0)
+        return;
+    cmd = lookupCommand(gTokens[0]);
+    if (cmd == NUM_COMMANDS){
+        fprintf(stderr, "Unrecognized command %s.\n", gTokens[0]);
+        return;
+    }
+    (void) dispatchCommand(cmd);
+}
+
+
+/*
+ *  Blocks of commands run by repeat, for and workers.  A block is compiled once into an array of
+ *  commands, each holding its command number and a private copy of its tokens, so running
+ *  it again and again doesn't re-tokenize or look anything up.
+ */
+struct compiledCommand {
+    enum command_enum cmd;
+    int tokenCount;
+    char **tokens;                           /*  NULL-terminated copy of the command's tokens  */
+    long long count;                         /*  repeat:  number of times to run the body, workers:  threads  */
+    long long durationNs;                    /*  for:  how long to keep running the body  */
+    struct compiledBlock *body;              /*  repeat, for and workers:  commands to run  */
+};
+
+struct compiledBlock {
+    int length, allocated;
+    struct compiledCommand *commands;
+};
+
+struct compileState {
+    char *line;                              /*  Line being compiled  */
+    char *tokens[MAXTOKENS];                 /*  Its tokens  */
+    int count, next;                         /*  Number of tokens, and the next one to compile  */
+};
+
+
+/*  Free a compiled block.  */
+static void freeBlock(struct compiledBlock *block)
+{
+    int i;
+    
+    if (block == NULL)
+        return;
+    for (i = 0; i < block->length; i++){
+        free(block->commands[i].tokens);
+        freeBlock(block->commands[i].body);
+    }
+    free(block->commands);
+    free(block);
+}
+
+
+/*
+ *  Copy count tokens into a single allocation holding a NULL-terminated array of pointers
+ *  followed by the strings.  In a worker's copy (worker >= 0), $w becomes the worker number.
+ */
+static char **copyTokens(char *const from[], int count, int worker)
+{
+    char number[16], **tokens, *to;
+    const char *p;
+    int i, size = 0;
+    
+    snprintf(number, sizeof(number), "%d", worker);
+    for (i = 0; i < count; i++)
+        size += (strlen(from[i]) + 1) * strlen(number);
+    tokens = malloc((count + 1) * sizeof(char *) + size);
+    if (tokens == NULL){
+        fprintf(stderr, "Unable to allocate compiled block.\n");
+        return NULL;
+    }
+    to = (char *)&tokens[count + 1];
+    for (i = 0; i < count; i++){
+        tokens[i] = to;
+        for (p = from[i]; *p != 0; p++){
+            if (worker >= 0 && p[0] == '$' && tolower((unsigned char) p[1]) == 'w'){
+                to = stpcpy(to, number);
+                p++;
+            } else
+                *to++ = *p;
+        }
+        *to++ = 0;
+    }
+    tokens[count] = NULL;
+    return tokens;
+}
+
+
+static struct compiledBlock *compileBlock(struct compileState *state, int nested);
+
+/*  Compile the statement at the next token onto the end of a block.  Returns FALSE on error.  */
+static int compileStatement(struct compileState *state, struct compiledBlock *block)
+{
+    struct compiledCommand *command, *newCommands;
+    int first = state->next, count;
+    
+    /*  The statement runs up to a ; { or } token, or the end of the line.  */
+    while (state->next < state->count && strcmp(state->tokens[state->next], ";") != 0 &&
+            strcmp(state->tokens[state->next], "{") != 0 && strcmp(state->tokens[state->next], "}") != 0)
+        state->next++;
+    count = state->next - first;
+    if (count == 0){
+        fprintf(stderr, "Missing command before %s.\n", state->tokens[state->next]);
+        return FALSE;
+    }
+    
+    /*  Make room for it.  */
+    if (block->length == block->allocated){
+        block->allocated = block->allocated ? block->allocated * 2 : 8;
+        newCommands = realloc(block->commands, block->allocated * sizeof(*newCommands));
+        if (newCommands == NULL){
+            fprintf(stderr, "Unable to allocate compiled block.\n");
+            return FALSE;
+        }
+        block->commands = newCommands;
+    }
+    command = &block->commands[block->length];
+    memset(command, 0, sizeof(*command));
+    
+    /*  Look up the command and keep a copy of its tokens.  */
+    command->cmd = lookupCommand(state->tokens[first]);
+    if (command->cmd == NUM_COMMANDS){
+        fprintf(stderr, "Unrecognized command %s.\n", state->tokens[first]);
+        return FALSE;
+    }
+    command->tokens = copyTokens(&state->tokens[first], count, -1);
+    if (command->tokens == NULL)
+        return FALSE;
+    command->tokenCount = count;
+    block->length++;
+    
+    /*  Loops and workers are followed by their body.  */
+    if (command->cmd == CMD_REPEAT || command->cmd == CMD_FOR || command->cmd == CMD_WORKERS){
+        if (count != 2 || state->next >= state->count || strcmp(state->tokens[state->next], "{") != 0){
+            fprintf(stderr, "gUsage:  %s.\n", gCommandTable[command->cmd].usage);
+            return FALSE;
+        }
+        if (command->cmd == CMD_REPEAT && 
+                (setSizeArgument(command->tokens[1], &command->count) != 0 || command->count < 0))
+            return FALSE;
+        if (command->cmd == CMD_FOR && setDurationArgument(command->tokens[1], &command->durationNs) != 0)
+            return FALSE;
+        if (command->cmd == CMD_WORKERS && (setSizeArgument(command->tokens[1], &command->count) != 0 ||
+                command->count < 1 || command->count > MAX_WORKERS)){
+            fprintf(stderr, "Between 1 and %d workers can be started.\n", MAX_WORKERS);
+            return FALSE;
+        }
+        state->next++;
+        command->body = compileBlock(state, TRUE);
+        if (command->body == NULL)
+            return FALSE;
+    }
+    
+    return TRUE;
+}
+
+
+/*
+ *  Compile statements until the end of the line, or for a nested block, until the closing }.
+ *  Nested blocks may continue onto further input lines.
+ */
+static struct compiledBlock *compileBlock(struct compileState *state, int nested)
+{
+    struct compiledBlock *block;
+    
+    block = calloc(1, sizeof(*block));
+    if (block == NULL){
+        fprintf(stderr, "Unable to allocate compiled block.\n");
+        return NULL;
+    }
+    
+    for (;;){
+        
+        /*  Get another line if a nested block isn't finished.  */
+        if (state->next >= state->count){
+            if (!nested)
+                return block;
+            free(state->line);
+            state->line = getCommandLine("> ");
+            state->count = state->line ? tokenizeLine(state->line, state->tokens) : -1;
+            state->next = 0;
+            if (state->count < 0){
+                fprintf(stderr, "Missing } at end of block.\n");
+                break;
+            }
+            continue;
+        }
+        
+        if (strcmp(state->tokens[state->next], ";") == 0)
+            state->next++;
+        else if (strcmp(state->tokens[state->next], "}") == 0){
+            state->next++;
+            if (nested)
+                return block;
+            fprintf(stderr, "Unexpected }.\n");
+            break;
+        } else if (!compileStatement(state, block))
+            break;
+    }
+    
+    freeBlock(block);
+    return NULL;
+}
+
+
+/*  Make a worker's copy of a compiled block.  */
+static struct compiledBlock *copyBlock(const struct compiledBlock *block, int worker)
+{
+    struct compiledBlock *copy;
+    struct compiledCommand *command;
+    int i;
+    
+    copy = calloc(1, sizeof(*copy));
+    if (copy == NULL || (copy->commands = calloc(block->length, sizeof(*command))) == NULL){
+        fprintf(stderr, "Unable to allocate compiled block.\n");
+        free(copy);
+        return NULL;
+    }
+    copy->allocated = block->length;
+    for (i = 0; i < block->length; i++){
+        command = &copy->commands[i];
+        *command = block->commands[i];
+        command->body = NULL;
+        command->tokens = copyTokens(block->commands[i].tokens, command->tokenCount, worker);
+        copy->length++;
+        if (command->tokens == NULL || 
+                (block->commands[i].body != NULL && (command->body = copyBlock(block->commands[i].body, worker)) == NULL)){
+            freeBlock(copy);
+            return NULL;
+        }
+    }
+    return copy;
+}
+
+
+static void runWorkers(struct compiledCommand *command);
+
+/*  Run a compiled block.  Returns TRUE if it was quit.  */
+static int runBlock(struct compiledBlock *block)
+{
+    struct compiledCommand *command;
+    long long i, endNs;
+    int done = FALSE;
+    
+    for (command = block->commands; command < block->commands + block->length && !done; command++){
+        switch (command->cmd){
+            case CMD_REPEAT:
+                for (i = 0; i < command->count && !done && !gInterrupted; i++)
+                    done = runBlock(command->body);
+                break;
+            case CMD_FOR:
+                endNs = nowNs() + command->durationNs;
+                while (nowNs() < endNs && !done && !gInterrupted)
+                    done = runBlock(command->body);
+                break;
+            case CMD_WORKERS:
+                runWorkers(command);
+                break;
+            default:
+                memcpy(gTokens, command->tokens, (command->tokenCount + 1) * sizeof(char *));
+                gTokenCount = command->tokenCount;
+                done = dispatchCommand(command->cmd);
+                break;
+        }
+        if (gInterrupted)
+            break;
+    }
+    return done;
+}
+
+
+/*
+ *  Workers.  Each worker is a thread running its own copy of a block, with its own socket
+ *  table, model, epoll instance, io_uring and histograms, as all of those are __thread.
+ *  When they have all finished, their results are added together.
+ */
+struct worker {
+    pthread_t thread;
+    int number;
+    struct compiledBlock *body;              /*  Worker's copy of the block  */
+    enum model_enum model;                   /*  Model it starts in, and the io_uring options  */
+    int batch, fixedFiles, fixedBuffers;
+    long long tickNs;
+    long long elapsedNs;                     /*  Time it took to run the block  */
+    struct socketInfo totals;                /*  Totals over all the sockets it used  */
+    struct histogram *histograms[NUM_COMMANDS][NUM_MODELS];
+    long blocked[NUM_COMMANDS][NUM_MODELS];
+    struct histogram *signalLatency;         /*  rtsignal delivery latency, if any  */
+};
+
+
+/*  Body of a worker thread.  */
+static void *workerThread(void *arg)
+{
+    struct worker *worker = arg;
+    long long start;
+    int slot;
+    
+    gWorker = worker->number;
+    gModel = worker->model;
+    gRing.batch = worker->batch;
+    gRing.fixedFiles = worker->fixedFiles;
+    gRing.fixedBuffers = worker->fixedBuffers;
+    gTickNs = worker->tickNs;
+    if (growSocketTable() < 0)
+        return NULL;
+    if (gModel == IOURING_MODEL && (uringSetup() < 0 || uringRegister() < 0)){
+        uringTeardown();
+        free(gSockets);
+        return NULL;
+    }
+    
+    start = nowNs();
+    (void) runBlock(worker->body);
+    worker->elapsedNs = nowNs() - start;
+    
+    /*  Close whatever the worker left open, and hand its results back.  */
+    for (slot = 0; slot < gSocketSlots; slot++){
+        if (gSockets[slot].fd != UNUSED_FD){
+            gCurrent = slot;
+            doClose();
+        }
+    }
+    worker->totals = gRetired;
+    memcpy(worker->histograms, gHistograms, sizeof(gHistograms));
+    memcpy(worker->blocked, gBlocked, sizeof(gBlocked));
+    if (gEpollFd != UNUSED_FD)
+        (void) close(gEpollFd);
+    if (gSignalFd != UNUSED_FD)
+        (void) close(gSignalFd);
+    worker->signalLatency = gSignalLatency;
+    free(gTcpSamples);
+    uringTeardown();
+    free(gSockets);
+    return NULL;
+}
+
+
+/*  Print what the workers did, and add their latencies to this thread's.  */
+static void reportWorkers(struct worker workers[], int count, long long elapsedNs)
+{
+    struct socketInfo total, *t;
+    struct histogram merged, *h;
+    enum command_enum cmd;
+    enum model_enum m;
+    char label[40];
+    long long ns;
+    long blocked;
+    int i, found, headerPrinted = FALSE;
+    
+    memset(&total, 0, sizeof(total));
+    printf("%6s %12s %10s %8s %14s %14s %10s %10s\n", "worker", "elapsed ms", "calls", "errors", 
+                "bytes in", "bytes out", "MB/s in", "MB/s out");
+    for (i = 0; i <= count; i++){
+        t = i < count ? &workers[i].totals : &total;
+        ns = i < count ? workers[i].elapsedNs : elapsedNs;
+        if (i < count){
+            total.apiCalls += t->apiCalls;
+            total.apiErrors += t->apiErrors;
+            total.bytesIn += t->bytesIn;
+            total.bytesOut += t->bytesOut;
+            printf("%6d ", i);
+        } else
+            printf("%6s ", "total");
+        printf("%12.3f %10ld %8ld %14lld %14lld %10.1f %10.1f\n", ns / 1e6, t->apiCalls, t->apiErrors, 
+                    t->bytesIn, t->bytesOut, ns ? t->bytesIn * 1e3 / ns : 0.0, 
+                    ns ? t->bytesOut * 1e3 / ns : 0.0);
+    }
+    
+    for (cmd = 0; cmd < NUM_COMMANDS; cmd++){
+        for (m = 0; m < NUM_MODELS; m++){
+            histReset(&merged);
+            blocked = 0;
+            for (i = found = 0; i < count; i++){
+                if (workers[i].histograms[cmd][m] != NULL){
+                    histMerge(&merged, workers[i].histograms[cmd][m]);
+                    blocked += workers[i].blocked[cmd][m];
+                    found = TRUE;
+                }
+            }
+            if (!found || merged.count == 0)
+                continue;
+            if (!headerPrinted){
+                histPrintHeader("all workers");
+                headerPrinted = TRUE;
+            }
+            snprintf(label, sizeof(label), "%s/%s", gCommandTable[cmd].name, gModelNames[m]);
+            histPrintLine(label, &merged);
+            printf("%-24s %10.0f per second\n", "", merged.count * 1e9 / elapsedNs);
+            if (blocked != 0)
+                printf("%-24s %10ld blocked\n", "", blocked);
+            
+            /*  So stats includes what the workers did.  */
+            h = getHistogram(cmd, m);
+            if (h != NULL)
+                histMerge(h, &merged);
+            gBlocked[cmd][m] += blocked;
+        }
+    }
+    
+    /*  rtsignal delivery latency.  */
+    histReset(&merged);
+    for (i = 0; i < count; i++)
+        if (workers[i].signalLatency != NULL)
+            histMerge(&merged, workers[i].signalLatency);
+    if (merged.count != 0){
+        histPrintHeader("signal delivery ns");
+        histPrintLine("send to rtsignal", &merged);
+        if (gSignalLatency == NULL && (gSignalLatency = malloc(sizeof(*gSignalLatency))) != NULL)
+            histReset(gSignalLatency);
+        if (gSignalLatency != NULL)
+            histMerge(gSignalLatency, &merged);
+    }
+}
+
+
+/*  Implement the workers block:  run its body in count threads at once.  */
+static void runWorkers(struct compiledCommand *command)
+{
+    struct worker *workers;
+    long long start;
+    int i, count = command->count, started, result;
+    enum command_enum cmd;
+    enum model_enum m;
+    
+    if (gWorker >= 0){
+        fprintf(stderr, "Workers can't start workers of their own.\n");
+        return;
+    }
+    if (gModel == SIGNAL_MODEL){
+        fprintf(stderr, "Workers can't use the signal model, as SIGIO goes to the whole process.\n");
+        return;
+    }
+    workers = calloc(count, sizeof(*workers));
+    if (workers == NULL){
+        fprintf(stderr, "Unable to allocate %d workers.\n", count);
+        return;
+    }
+    for (i = 0; i < count; i++){
+        workers[i].number = i;
+        workers[i].model = gModel;
+        workers[i].batch = gRing.batch;
+        workers[i].fixedFiles = gRing.fixedFiles;
+        workers[i].fixedBuffers = gRing.fixedBuffers;
+        workers[i].tickNs = gTickNs;
+        workers[i].body = copyBlock(command->body, i);
+        if (workers[i].body == NULL)
+            break;
+    }
+    
+    start = nowNs();
+    for (started = 0; started < count && workers[started].body != NULL; started++){
+        result = pthread_create(&workers[started].thread, NULL, workerThread, &workers[started]);
+        if (result != 0){
+            fprintf(stderr, "Unable to start worker %d - %s.\n", started, strerror(result));
+            break;
+        }
+    }
+    for (i = 0; i < started; i++)
+        (void) pthread_join(workers[i].thread, NULL);
+    if (started > 0)
+        reportWorkers(workers, started, nowNs() - start);
+    
+    for (i = 0; i < count; i++){
+        freeBlock(workers[i].body);
+        for (cmd = 0; cmd < NUM_COMMANDS; cmd++)
+            for (m = 0; m < NUM_MODELS; m++)
+                free(workers[i].histograms[cmd][m]);
+        free(workers[i].signalLatency);
+    }
+    free(workers);
+}
+
+
+int main(int argc, char *argv[])
 {
     int retval = 0;
     char option;
-    int i;
+    int i, j;
     char promptStr[MAX_PROMPT_LENGTH];
     char *modelStr;
-    char *command, *tokenPtr;
-    int done = FALSE;
+    char *command;
+    int done = FALSE, separated;
+    struct rlimit fileLimit;
+    long long commandStart;
+    struct compileState state;
+    struct compiledBlock *block;
     
     /*  Process command line arguments      */
-    while (retval == 0 && (option = getopt(argc, argv, "v")) != -1){
+    while (retval == 0 && (option = getOption(argc, argv, "vf:")) != -1){
         switch (option){        
             case 'v':
                 gVerbose = TRUE;
                 break;          
+            case 'f':
+                gScript = strcmp(gOptarg, "-") == 0 ? stdin : fopen(gOptarg, "r");
+                if (gScript == NULL){
+                    fprintf(stderr, "Unable to open %s - %s.\n", gOptarg, strerror(errno));
+                    return 1;
+                }
+                break;          
             case '?':
             default:
                 showgUsage();
                 return 1;
         }
     }
-    if (optind < argc){
+    if (gOptind < argc){
         fprintf(stderr, "Unexpected argument(s) at end of command.\n");
-        return;
+        return 1;
     }
     if (retval)
         return retval;
     
     /*  Do sanity checks on the arguments.  */
     
+    /*  Allow as many open sockets as we are permitted, and set up the socket table.  */
+    if (getrlimit(RLIMIT_NOFILE, &fileLimit) == 0 && fileLimit.rlim_cur < fileLimit.rlim_max){
+        fileLimit.rlim_cur = fileLimit.rlim_max;
+        (void) setrlimit(RLIMIT_NOFILE, &fileLimit);
+    }
+    if (growSocketTable() < 0)
+        return 1;
+    if (buildNameIndex(&gCommandIndex, &gCommandTable[0].name, sizeof(gCommandTable[0]), NUM_COMMANDS) != 0){
+        fprintf(stderr, "Unable to index command names.\n");
+        return 1;
+    }
+    
     /*  Initialize signal handlers.  */
     signal(SIGINT, interruptSignalHandler);
     signal(SIGTSTP, interruptSignalHandler);    
@@ -1480,44 +6312,18 @@ int main(int argc, char *argv[], char *envp[])
     while (!done){
 
         /*  Build the prompt string.  */
-        switch (model){
-            case BLOCKING_MODEL:
-            default:
-                modelStr = "blocking";
-                break;
-            case NONBLOCKING_MODEL:
-                modelStr = "nonblocking";
-                break;
-            case SELECT_MODEL:
-                modelStr = "select";
-                break;          
-            case SIGNAL_MODEL:
-                modelStr = "signal";
-                break;
-        }
+        modelStr = gModelNames[gSockets[gCurrent].model];
         snprintf(promptStr, MAX_PROMPT_LENGTH, "%s %d:  " , modelStr, gCurrent);
 
         /*  Input a (non-empty) command.  */
-        do 
-            command = readline(promptStr);
-        while (*command == 0);
-	 if (command == NULL)
-	 	break;
-        add_history(command);
-    
-        /*  Force to all lower-case.  */
-        for (i = 0; i < strlen(command); i++)
-            command[i] = tolower(command[i]);
-        
+        command = getCommandLine(promptStr);
+        if (command == NULL)
+            break;
+    
         /*  Break the string into tokens, in-place.  */
-        tokenPtr = command;
-        for (gTokenCount = 0; gTokenCount < MAXTOKENS; gTokenCount++){
-            gTokens[gTokenCount] = strsep(&tokenPtr, CMDDELIMS);
-            if (gTokens[gTokenCount] == NULL)
-                break;
-        }
-        if (gTokenCount >= MAXTOKENS){
-            fprintf(stderr, "Too many tokens in input line.\n");
+        gTokenCount = tokenizeLine(command, gTokens);
+        if (gTokenCount <= 0){
+            free(command);
             continue;
         }
 #if IFY_DO_NOT_COMPILE
@@ -1527,41 +6333,40 @@ int main(int argc, char *argv[], char *envp[])
 #endif
         
         /*  Find the command.  */
-        for (i = 0; i < NUM_COMMANDS; i++){
-            if (strcmp(gTokens[0], gCommands[i]) == 0)
-                break;
+        i = lookupCommand(gTokens[0]);
+        if (i == NUM_COMMANDS){
+            if (gScript != NULL)
+                fprintf(stderr, "Line %ld:  ", gLineNumber);
+            fprintf(stderr, "Unrecognized command.\n");
+            free(command);
+            continue;
         }
         
-        /*  Dispatch to the command processor.  */
-        gInterrupted = FALSE;
-        switch (i){
+        /*  
+         *  Run the command, or compile and run the block it starts.  A line of several 
+         *  commands is compiled as a block too, so each gets only its own tokens.
+         */
+        for (separated = FALSE, j = 1; j < gTokenCount && !separated; j++)
+            separated = strchr(CMDSEPARATORS, gTokens[j][0]) != NULL;
+        commandStart = nowNs();
+        if (separated || i == CMD_REPEAT || i == CMD_FOR || i == CMD_WORKERS){
+            memcpy(state.tokens, gTokens, sizeof(state.tokens));
+            state.line = command;
+            state.count = gTokenCount;
+            state.next = 0;
+            block = compileBlock(&state, FALSE);
+            command = state.line;
+            if (block != NULL){
+                gInterrupted = FALSE;
+                done = runBlock(block);
+                freeBlock(block);
+            }
+        } else 
+            done = dispatchCommand(i);
         
-            case CMD_QUIT:        done = TRUE;      break;
-            case CMD_HELP:        doHelp();         break;
-            case CMD_MODEL:       doModel();        break;
-            case CMD_USE:         doUse();          break;
-            case CMD_SOCKET:      doSocket();       break;
-            case CMD_BIND:        doBind();         break;
-            case CMD_CONNECT:     doConnect();      break;
-            case CMD_LISTEN:      doListen();       break;
-            case CMD_ACCEPT:      doAccept();       break;
-            case CMD_RECVMSG:     doRecvmsg();      break;
-            case CMD_SENDMSG:     doSendmsg();      break;
-            case CMD_READ:        doRead();         break;
-            case CMD_WRITE:       doWrite();        break;
-            case CMD_SETSOCKOPT:  doSetsockopt();   break;
-            case CMD_GETSOCKOPT:  doGetsockopt();   break;
-            case CMD_MULTIJOIN:   doMultijoin();    break;
-            case CMD_MULTILEAVE:  doMultileave();   break;
-            case CMD_GETSOCKNAME: doGetsockname();  break;
-            case CMD_GETPEERNAME: doGetpeername();  break;
-            case CMD_SHUTDOWN:    doShutdown();     break;
-            case CMD_CLOSE:       doClose();        break;
-             
-             default:
-                fprintf(stderr, "Unrecognized command.\n");
-                continue;
-        }
+        /*  In batch mode, show how long each command took.  */
+        if (gScript != NULL)
+            printf("line %ld, %s:  %lld ns\n", gLineNumber, gCommandTable[i].name, nowNs() - commandStart);
         
         free(command);
     }